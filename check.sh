@@ -0,0 +1,9 @@
+#!/bin/sh
+# Regression check: build the simulator, compare its output for search.txt
+# with the golden files, and gate its throughput on the stored baseline.
+# To record a new baseline, delete baseline.txt and run the check again.
+set -e
+cd "$(dirname "$0")"
+${CC:-gcc} -Wall -O2 -o runsearch demandpaging.c -lpthread
+./runsearch -X output.txt,verboseoutput.txt -B baseline.txt -b 200
+./runsearch -A greedy -X output_real.txt -b 1
@@ -1,6 +1,18 @@
+#define _POSIX_C_SOURCE 200809L  // open_memstream, fdopen and getopt under -std=c11
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
 
 // Constants
 #define PAGE_SIZE 4096  // 4 KB
@@ -9,54 +21,568 @@
 #define PAGE_TABLE_SIZE 2048
 #define ESSENTIAL_PAGES 10
 #define VALID_BIT_MASK 0x8000  // Most significant bit
-#define MAX_PROCESSES 500  // Maximum number of processes
-#define MAX_SEARCHES 100   // Maximum searches per process
+#define MAX_FRAMES VALID_BIT_MASK  // Frame numbers must fit below the valid bit
+#define RESIDENT_WORDS (PAGE_TABLE_SIZE / 64)  // 64-bit words in a resident-page bitmap
+#define ARENA_ALIGN 64  // Alignment of each block carved from the state arena
+#define MAX_PATH_LEN 256   // Maximum input file name length in a sweep file
+#define TRACE_MAGIC "DPTRACE1"  // First bytes of a binary trace file
+#define CHECKPOINT_MAGIC "DPCHECK1"  // First bytes of a checkpoint file
+#define CHECKPOINT_CHUNK 4096  // Arena bytes per chunk; all-zero chunks are not stored
+#define NO_FRAME -1  // End of a replacement list
+#define HOT_SET_MAX 64  // Largest hot set kept across a swap (one bit each in a mask)
+#define EVENT_MAGIC "DPEVENT1"  // First bytes of a binary event trace
+#define EVENT_RING_SIZE 4096  // Events buffered before a bulk write
+#define REFS_MAGIC "DPREFS01"  // First bytes of a recorded reference string
+#define REFS_BUFFER 4096  // References buffered before a bulk write
+#define REF_PAGE_BITS 11  // Page number bits of a reference (PAGE_TABLE_SIZE pages)
+#define REF_REPEAT 0x80000000u  // The page was probed again right after
+#define MAX_REF_PROCESSES (1 << (31 - REF_PAGE_BITS))  // Processes a reference can name
+#define STREAM_KEYS 64  // Searches a streamed process can have queued (a power of two)
+#define STREAM_LINE 128  // Longest command line of a stream
+#define CHECK_LINE 256  // Longest line of a golden output
+#define CHECK_RUNS 25  // Timed runs of a check; the fastest one counts
+#define CHECK_FLOOR 0.8  // Lowest throughput a check passes, as a share of the baseline
+#define VERBOSE_EVENTS 0x1    // Set-up and swap messages (the default output)
+#define VERBOSE_SEARCHES 0x2  // One line per search
+#define VERBOSE_FAULTS 0x4    // One line per page fault
+#ifdef VERBOSE
+#define DEFAULT_VERBOSITY (VERBOSE_EVENTS | VERBOSE_SEARCHES)
+#else
+#define DEFAULT_VERBOSITY VERBOSE_EVENTS
+#endif
+#ifdef __AVX2__
+#define PATH_BATCH 8   // Searches advanced together by the batch search kernel
+#else
+#define PATH_BATCH 4   // As many 32-bit lanes as a 128-bit register holds
+#endif
+#define MAX_PROBES 32  // Probes of a search over at most 2^31 elements
+#define FRAME_WORDS(frames) (((frames) + 63) / 64)  // 64-bit words in a frame bitmap
+#define MAX_QUEUE_DEPTH 64  // Requests a storage device can have in service at once
+#define SHARE_BY_SIZE -1  // Processes with arrays of the same size share their data pages
+
+// What to do when a page fault finds no free frame
+typedef enum {
+    REPLACE_NONE,   // Swap the faulting process out (the problem statement)
+    REPLACE_FIFO,   // Evict the data page loaded first
+    REPLACE_LRU,    // Evict the data page accessed least recently
+    REPLACE_CLOCK   // Second chance: FIFO skipping pages referenced since the last pass
+} ReplacementPolicy;
+
+// How many swapped-out processes to bring back when a process terminates
+typedef enum {
+    ADMIT_SINGLE,       // One per termination (the problem statement)
+    ADMIT_GREEDY,       // While the essential pages of the next one fit
+    ADMIT_WORKING_SET   // While the projected working set of the next one fits
+} AdmissionPolicy;
+
+// Which process to swap out when a fault finds no frame, and which to swap
+// in first
+typedef enum {
+    SWAP_FAULTING,     // The faulting one; swap-ins in swap-out order (the problem statement)
+    SWAP_WORKING_SET,  // The one holding most frames outside its working set; smallest working set first
+    SWAP_PFF           // The one with the highest page-fault frequency; lowest first
+} SwapPolicy;
+
+// Storage device holding the swap area. All times are in nanoseconds.
+typedef struct {
+    int queue_depth;  // Requests in service at once (0: no model, paging takes no time)
+    long latency;     // Per request, before its transfer starts
+    long bandwidth;   // MB/s, shared by all requests (0: unlimited)
+    long access_time;  // CPU time of one page access
+} StorageModel;
+
+// Set-associative TLB in front of the page tables, with LRU replacement
+// within a set
+typedef struct {
+    int entries;  // 0: no TLB
+    int ways;
+    int asid;  // Entries are tagged with the process, so a context switch keeps them
+    long memory_time;  // ns per memory access, for the effective access time
+} TlbModel;
+
+// Simulation parameters (one configuration of a sweep)
+typedef struct {
+    char input_file[MAX_PATH_LEN];
+    int user_frames;
+    int essential_pages;
+    int page_size;
+    int data_page_size;  // Bytes per data page, a power-of-two multiple of page_size (0: page_size)
+    ReplacementPolicy policy;
+    int local_replacement;  // Victims come from the faulting process only
+    int hot_set_size;  // Top-of-tree data pages restored on swap-in (0: off)
+    AdmissionPolicy admission;
+    int frame_report;  // Print frame allocator statistics
+    unsigned verbosity;  // VERBOSE_* categories to print
+    long sample_interval;  // Page accesses between time-series samples (0: none)
+    int batch_search;  // Batch search kernel (needs a power-of-two page size)
+    StorageModel storage;
+    int prefetch_depth;  // Pages of the search path read ahead on a fault (0: off)
+    int page_table_levels;  // 1: flat page tables, 2: directory and lazily allocated leaves
+    int datasets;  // Data pages shared by dataset: 0 none, SHARE_BY_SIZE, else process i in i % datasets
+    TlbModel tlb;
+    SwapPolicy scheduler;
+    long window;  // Accesses of a process in its working-set or fault-frequency window
+} SimConfig;
+
+// Input workload: for each process its array size followed by its search
+// keys, packed as num_processes records of (num_searches + 1) ints
+typedef struct {
+    int num_processes;
+    int num_searches;
+    const int *records;
+    int *owned;      // Records parsed from a text file, or NULL
+    void *mapping;   // Mapped binary trace file, or NULL
+    size_t mapping_size;
+} Trace;
 
-// Process state structure
+// Header of a binary trace file, followed by the packed records as native
+// 32-bit integers
 typedef struct {
-    unsigned short page_table[PAGE_TABLE_SIZE];
-    int array_size;
-    int search_indices[MAX_SEARCHES];
+    char magic[8];
+    int32_t num_processes;
+    int32_t num_searches;
+} TraceHeader;
+
+_Static_assert(sizeof(int) == sizeof(int32_t), "trace records are stored as 32-bit ints");
+
+// Distribution of the search keys of a generated workload
+typedef enum {
+    KEYS_UNIFORM,    // Any index of the array, equally likely
+    KEYS_ZIPF,       // Index i with probability proportional to (i + 1)^-s
+    KEYS_SEQUENTIAL  // Evenly spaced indices in increasing order
+} KeyDistribution;
+
+// Synthetic workload, generated in-process instead of read from a file
+typedef struct {
+    int num_processes;
     int num_searches;
-    int current_search;
+    int min_size;  // Array sizes are uniform in [min_size, max_size]
+    int max_size;
+    KeyDistribution keys;
+    double zipf_exponent;
+    uint64_t seed;
+} Workload;
+
+// One lane per search for the batch search kernel. GCC lowers these to
+// AVX2 or NEON registers when the target has them, SSE2 otherwise.
+typedef int lane_vector __attribute__((vector_size(PATH_BATCH * sizeof(int))));
+typedef unsigned short page_vector __attribute__((vector_size(PATH_BATCH * sizeof(unsigned short))));
+
+// Probe pages of PATH_BATCH consecutive searches of a process
+typedef struct {
+    page_vector pages[MAX_PROBES];  // pages[probe][lane], lane i for search first + i
+    unsigned char length[PATH_BATCH];  // Probes of each search
+    int first;  // -PATH_BATCH until the first batch is computed
+} SearchPaths;
+
+// Process state structure. The fields the scheduler reads on every step
+// (active flag, current search, array size) live in SystemState arrays.
+typedef struct {
+    unsigned short *page_table;  // PAGE_TABLE_SIZE entries (flat page tables)
+    unsigned short **directory;  // RESIDENT_WORDS leaves of 64 entries, NULL when empty (two-level)
+    uint64_t *resident_map;  // RESIDENT_WORDS words: pages whose valid bit is set
+    uint32_t resident_words;  // Non-zero words of resident_map
+    const int *search_indices;  // num_searches entries, owned by the Trace (a ring when streaming)
     int frames_allocated;
-    int is_active;
+    unsigned short *hot_pages;  // Data pages of the top search-tree levels
+    int num_hot_pages;
+    uint64_t restore_mask;  // hot_pages that were resident at the last swap-out
+    uint64_t *prefetched_map;  // RESIDENT_WORDS words: restored pages not accessed yet
+    uint64_t *readahead_map;   // RESIDENT_WORDS words: read-ahead pages not accessed yet
+    int working_set;  // Frames it was holding plus the one it lacked at its last swap-out
+    SearchPaths *paths;  // Batch search kernel only
+    long window_start;  // Page accesses of the process when its fault window opened (SWAP_PFF)
+    int window_faults;  // Faults in the current window
+    int recent_faults;  // Faults in the window before
+    int fault_frequency;  // Faults over the last two windows at its last swap-out
 } Process;
 
-// Queue structure for swap management
+_Static_assert(RESIDENT_WORDS <= 32, "resident_words has one bit per resident_map word");
+
+// Per-process counters, kept apart from the scheduling and paging state
+typedef struct {
+    long page_accesses;
+    long page_faults;
+    int swap_outs;
+    int peak_frames;
+} ProcessStats;
+
+// State of memory at one point of the run
+typedef struct {
+    long time;  // Page accesses so far
+    int free_frames;
+    int active;   // Not swapped out, as printed (finished processes included)
+    int running;  // Active and not finished
+    int swapped;
+} Sample;
+
+// Replacement order of a set of frames, linked through the frame arrays
+typedef struct {
+    int head;  // Next victim candidate
+    int tail;  // Most recently loaded (or, for LRU, accessed) frame
+} FrameList;
+
+// Free user frames as a bitmap (a set bit is a free frame), with a summary
+// bit per non-empty word. Frames are handed out lowest first, and a run of
+// contiguous frames can be taken in one go. Data pages of several frames
+// take an aligned unit of them, found through a bitmap of wholly free units.
+typedef struct {
+    uint64_t *free_map;  // FRAME_WORDS(user_frames) words
+    uint64_t *summary;   // FRAME_WORDS(FRAME_WORDS(user_frames)) words
+    int num_words;
+    uint64_t *unit_map;  // FRAME_WORDS(num_units) words, if data pages span several frames
+    int num_units;       // Aligned units of data_units frames in the user frames
+    int free_units;
+    long batches;             // Batch allocations of essential pages
+    long contiguous_batches;  // Batches served by one run of frames
+    long free_extents;        // Runs of free frames, summed over the batches
+} FramePool;
+
+// Circular queue of process ids (swap, ready and resume queues)
 typedef struct {
-    int items[MAX_PROCESSES];
+    int *items;
+    int capacity;
     int front;
     int rear;
 } SwapQueue;
 
-// System state structure
+// Kinds of traced events
+typedef enum {
+    EVENT_INIT,          // Simulation data read, kernel data initialized
+    EVENT_FAULT,         // arg: faulting page
+    EVENT_SWAP_OUT,      // arg: active processes after the swap
+    EVENT_SWAP_IN,       // arg: degree of multiprogramming so far (as printed)
+    EVENT_SEARCH_START,  // arg: search number, from 1
+    EVENT_SEARCH_END,    // arg: search number, from 1
+    EVENT_SUMMARY        // Followed by an EventSummary; always the last event
+} EventType;
+
+// Fixed-size trace record. The timestamp is logical: page accesses so far.
+typedef struct {
+    int64_t time;
+    int32_t process_id;
+    uint32_t type_arg;  // EventType in the low 8 bits, its argument (< 2^24) above
+} TraceEvent;
+
+#define EVENT_TYPE(event) ((event)->type_arg & 0xff)
+#define EVENT_ARG(event) ((int)((event)->type_arg >> 8))
+
+_Static_assert(sizeof(TraceEvent) == 16, "trace events are packed in 16 bytes");
+
+// Totals of a traced run, enough for the decoder to print its statistics
+typedef struct {
+    int64_t page_accesses;
+    int64_t page_faults;
+    int64_t num_evictions;
+    int64_t hot_pages_restored;
+    int64_t hot_faults_saved;
+    int64_t batches;
+    int64_t contiguous_batches;
+    int64_t free_extents;
+    int32_t num_swaps;
+    int32_t min_active_processes;
+    int32_t policy;
+    int32_t local_replacement;
+    int32_t hot_set_size;
+    int32_t frame_report;
+} EventSummary;
+
+// Header of a checkpoint file. It is followed by the SimConfig and the
+// SystemState of the run, a bitmap of the non-zero arena chunks, those
+// chunks in order, and the time-series samples. The state is stored as laid
+// out in memory, so a checkpoint is only valid for the same build; the sizes
+// recorded here catch most mismatches.
+typedef struct {
+    char magic[8];
+    uint32_t config_size;
+    uint32_t state_size;
+    uint64_t arena_size;
+    uint64_t arena_base;  // Address of the arena when written, to rebase pointers
+    uint64_t trace_checksum;
+    int32_t num_processes;
+    int32_t num_searches;
+    int32_t num_samples;
+    int32_t reserved;
+} CheckpointHeader;
+
+// Settings a resumed run may change, so that runs can branch off a checkpoint
+#define BRANCH_ADMISSION 0x1
+#define BRANCH_SCHEDULER 0x2
+#define BRANCH_WINDOW 0x4
+#define BRANCH_VERBOSITY 0x8
+
+// Header of an event trace file
+typedef struct {
+    char magic[8];
+    uint32_t verbosity;  // VERBOSE_* categories of the text output
+    uint32_t reserved;
+} EventHeader;
+
+// Events waiting to be written to the trace file
+typedef struct {
+    TraceEvent events[EVENT_RING_SIZE];
+    int count;
+    FILE *fp;
+    int failed;  // A write went wrong; the trace is incomplete
+} EventRing;
+
+// Header of a recorded reference string, followed by one uint32_t per
+// reference: process << REF_PAGE_BITS | page, with REF_REPEAT set when the
+// page was probed again at once. Repeats are folded into the reference
+// before them, so a search reads as its distinct run of pages.
+typedef struct {
+    char magic[8];
+    int32_t num_processes;
+    int32_t essential_pages;
+    int32_t page_size;
+    int32_t reserved;
+    int64_t accesses;    // Page accesses, repeats included
+    int64_t references;  // Records that follow
+} RefsHeader;
+
+// References waiting to be written to the reference string file
+typedef struct {
+    uint32_t refs[REFS_BUFFER];
+    int count;
+    FILE *fp;
+    int failed;
+    RefsHeader header;
+} RefRecorder;
+
+// Processes and searches arriving on a stream, in num_slots process slots
+// that are reused once their process has finished. Slot arrays have
+// num_slots entries.
+typedef struct {
+    FILE *in;
+    int num_slots;
+    int *keys;      // Slot records: array size, then a ring of STREAM_KEYS search keys
+    int *queued;    // Searches received; current_search counts those completed
+    unsigned char *in_use;
+    unsigned char *ended;    // The process will get no more searches
+    unsigned char *waiting;  // Active with no search queued, so in no queue
+    int *id;        // Stream id of the process in the slot
+    int *free_slots;
+    int num_free;
+    int *finished;  // Slots whose process has finished, to be reused
+    int num_finished;
+    int *table;     // Open addressing from ids to slots plus one
+    int table_mask;
+    long arrivals;
+    long searches;
+    long line;
+} StreamState;
+
+// System state structure. All per-process and per-frame data lives in one
+// arena sized from the input header and the frame budget.
 typedef struct {
-    int free_frames[TOTAL_FRAMES];
+    void *arena;
+    size_t arena_size;
+    FramePool frames;
     int num_free_frames;
-    Process processes[MAX_PROCESSES];
+    Process *processes;  // num_processes entries
     int num_processes;
+    int num_hosted;  // Processes that belong here (all of them, unless partitioned)
+    int num_searches;  // Searches per process
+    // Scheduling fields, one contiguous array each (num_processes entries)
+    unsigned char *is_active;  // Not swapped out (finished processes included)
+    int *current_search;
+    int *array_size;
     SwapQueue swap_queue;
-    int page_accesses;
-    int page_faults;
+    SwapQueue ready_queue;   // Runnable processes, served in FIFO order
+    SwapQueue resume_queue;  // Swapped back in, to run before the ready queue
+    long page_accesses;
+    long page_faults;
     int num_swaps;
     int min_active_processes;
+    int num_active;    // Processes not swapped out (finished ones included)
+    int num_finished;  // Processes that completed all their searches
+    double multiprogramming_area;  // Running processes integrated over page accesses
+    long multiprogramming_since;   // Page access count at the last change of the above
+    int user_frames;
+    int essential_pages;
+    int page_size;   // Of data pages
+    int page_shift;  // log2 of the array elements per data page, or -1 if not a power of two
+    int data_units;  // Frames per data page
+    long unit_shortfalls;  // Faults with enough free frames but no free unit for a data page
+    long data_bytes;  // Data pages of the hosted processes, and the part past their arrays
+    long data_slack;
+    unsigned verbosity;  // VERBOSE_* categories printed to out
+    FILE *out;
+    ReplacementPolicy policy;
+    int local_replacement;
+    // Replacement state (policy != REPLACE_NONE), user_frames entries each.
+    // Only data pages are linked; essential pages are never evicted.
+    int *frame_owner;
+    unsigned short *frame_page;
+    int *frame_prev;
+    int *frame_next;
+    unsigned char *frame_referenced;
+    FrameList *frame_lists;  // One global list, or one per process
+    long num_evictions;
+    int hot_set_size;
+    long hot_pages_restored;
+    long hot_faults_saved;  // Restored pages accessed before being released
+    int track_hits;  // Page hits need bookkeeping (replacement or hot set)
+    AdmissionPolicy admission;
+    int frame_report;
+    EventRing *events;  // Binary event trace being recorded, or NULL
+    StreamState *stream;  // Searches come from a stream, or NULL
+    int key_mask;  // Index mask of search_indices: all ones, or STREAM_KEYS - 1
+    ProcessStats *process_stats;  // num_processes entries
+    int batch_search;
+    long sample_interval;
+    long next_sample;  // Page access count of the next sample (LONG_MAX: none)
+    Sample *samples;   // Grown as the run goes
+    int num_samples;
+    int samples_capacity;
+    int restarts;  // Restarts from the swap queue since the last completed search
+    int stuck;     // The run stopped because no search could complete
+    int migrated_in;  // Processes moved here from another memory node
+    int migrated_out;
+    long searches_completed;
+    // Storage model (storage.queue_depth > 0). The CPU clock is the page
+    // accesses so far times their cost, plus the time stalled on the device.
+    StorageModel storage;
+    long page_transfer;  // Transfer time of one page
+    long io_stall;       // CPU time spent waiting for reads
+    long device_busy;    // Time with at least one request in service
+    long busy_until;     // End of the last request
+    long bus_free;       // End of the last transfer
+    long channel_free[MAX_QUEUE_DEPTH];  // End of the request on each queue slot
+    long pages_read;
+    long pages_written;
+    long runtime;  // Simulated time at the end of the run
+    long fault_ready;  // Completion of the last demand read
+    // Read-ahead on faults (prefetch_depth > 0)
+    int prefetch_depth;
+    long *frame_ready;  // user_frames entries: arrival of read-ahead pages (storage model only)
+    long prefetch_issued;
+    long prefetch_used;    // Accessed while resident
+    long prefetch_late;    // Accessed before their read completed
+    long prefetch_wasted;  // Released or evicted without being accessed
+    // Data pages shared by the processes of a dataset (datasets > 0)
+    int num_datasets;
+    int *dataset;  // num_processes entries
+    unsigned short *shared_frames;  // PAGE_TABLE_SIZE entries per dataset: frame | VALID_BIT_MASK, or 0
+    int *frame_refs;    // user_frames entries: page tables mapping each shared frame
+    long shared_faults;  // Faults served by a frame another process had brought in
+    int shared_mappings;  // Mappings of shared frames beyond the first, i.e. frames saved
+    int peak_shared_mappings;
+    // Leaf tables of two-level page tables, one per non-empty resident_map word
+    unsigned short (*leaves)[64];  // num_leaves entries
+    int *free_leaves;  // Stack of unused leaves
+    int num_leaves;
+    int num_free_leaves;
+    int peak_leaves;
+    // TLB (tlb.entries > 0): tlb_sets sets of tlb.ways entries
+    TlbModel tlb;
+    int tlb_sets;
+    uint64_t *tlb_tags;  // tlb.entries entries: page (and process, with ASIDs) plus one, or 0
+    long *tlb_used;      // tlb.entries entries: tlb_clock at the last use, 0 if empty
+    long tlb_clock;
+    int tlb_process;  // Process whose translations a TLB without ASIDs holds, or -1
+    int tlb_walk_levels;  // Page table accesses of a miss
+    long tlb_hits;
+    long tlb_misses;
+    long tlb_flushes;
+    SwapPolicy scheduler;
+    long window;
+    long *frame_stamp;  // user_frames entries: page accesses of the owner at the last use (SWAP_WORKING_SET)
+    long victim_swaps;  // Swap-outs of a process other than the faulting one
 } SystemState;
 
+// One entry of a sweep, with the figures of its finished simulation
+typedef struct {
+    SimConfig config;
+    const Trace *trace;  // NULL if the input file could not be loaded
+    int status;  // 0 on success, -1 if the simulation could not be set up
+    long page_accesses;
+    long page_faults;
+    long num_evictions;
+    long hot_faults_saved;
+    int num_swaps;
+    int min_active_processes;
+    double avg_multiprogramming;
+    long runtime;
+    long io_stall;
+    long device_busy;
+    long searches_completed;
+    char *log;  // Verbose output of the run, if it asked for any
+    size_t log_size;
+} SweepJob;
+
+// Work list shared by the sweep worker threads
+typedef struct {
+    SweepJob *jobs;
+    int num_jobs;
+    int next_job;
+    pthread_mutex_t lock;
+    Trace *traces;  // One per distinct input file, loaded before the run
+    int num_traces;
+} SweepPool;
+
 // Function prototypes
-void initQueue(SwapQueue *q);
+void initQueue(SwapQueue *q, int *items, int capacity);
 int queueIsEmpty(SwapQueue *q);
 void enqueue(SwapQueue *q, int process_id);
 int dequeue(SwapQueue *q);
 int get_active_process_count(SystemState *system);
+double average_multiprogramming(SystemState *system);
 void swap_out_process(SystemState *system, int process_id);
 void swap_in_process(SystemState *system, int process_id);
+void map_page(SystemState *system, Process *p, int page_num);
+void map_essential_pages(SystemState *system, Process *p);
+void release_pages(SystemState *system, Process *p);
+int evict_page(SystemState *system, int process_id);
 int handle_page_fault(SystemState *system, int process_id, int page_num);
-void simulate_binary_search(SystemState *system, int process_id);
+int simulate_binary_search(SystemState *system, int process_id);
 void print_statistics(SystemState *system);
+void init_config(SimConfig *config);
+int load_trace(Trace *trace, const char *file);
+int write_trace(const Trace *trace, const char *file);
+void free_trace(Trace *trace);
+int parse_workload(const char *spec, Workload *workload);
+int parse_storage(const char *spec, StorageModel *storage);
+int parse_tlb(const char *spec, TlbModel *tlb);
+int generate_trace(Trace *trace, const Workload *workload);
+int run_benchmark(const SimConfig *config, const Trace *trace, int runs);
+int run_check(const SimConfig *config, const Trace *trace, const char *golden_files, const char *baseline_file,
+              int runs);
+EventRing *open_event_trace(const char *file, unsigned verbosity);
+int close_event_trace(SystemState *system);
+int decode_event_trace(const char *file);
+int write_reference_string(const Trace *trace, const SimConfig *config, const char *file);
+int replay_reference_string(const char *file, const SimConfig *config);
+int write_process_stats(const SystemState *system, const char *file);
+int write_checkpoint(const SystemState *system, const SimConfig *config, const Trace *trace, const char *file);
+int restore_checkpoint(SystemState *system, SimConfig *config, const Trace *trace, const char *file,
+                       unsigned branch);
+int write_time_series(const SystemState *system, const char *file);
+int initialize_system(SystemState *system, const SimConfig *config, const Trace *trace);
+int initialize_node(SystemState *system, const SimConfig *config, const Trace *trace, int first, int count);
+const char *policy_name(ReplacementPolicy policy);
+int parse_policy(const char *name, ReplacementPolicy *policy);
+int parse_scope(const char *name, int *local_replacement);
+const char *admission_name(AdmissionPolicy admission);
+int parse_admission(const char *name, AdmissionPolicy *admission);
+int parse_verbosity(const char *name, unsigned *verbosity);
+void admit_swapped_processes(SystemState *system);
+const char *scheduler_name(SwapPolicy scheduler);
+int parse_scheduler(const char *name, SwapPolicy *scheduler);
+void free_system(SystemState *system);
+int run_simulation(SystemState *system);
+int run_quanta(SystemState *system, long quanta);
+int run_partitions(const SimConfig *config, const Trace *trace, int num_nodes, long epoch,
+                   int migrate, int num_threads);
+int run_sweep(const char *sweep_file, int num_threads);
+int run_stream(const SimConfig *config, const char *source, int num_slots, long report_interval);
 
 // Queue operations implementation
-void initQueue(SwapQueue *q) {
+static void queue_remove(SwapQueue *q, int process_id);
+
+void initQueue(SwapQueue *q, int *items, int capacity) {
+    q->items = items;
+    q->capacity = capacity;
     q->front = q->rear = -1;
 }
 
@@ -68,7 +594,7 @@ void enqueue(SwapQueue *q, int process_id) {
     if (q->front == -1) {
         q->front = q->rear = 0;
     } else {
-        q->rear = (q->rear + 1) % MAX_PROCESSES;
+        q->rear = (q->rear + 1) % q->capacity;
     }
     q->items[q->rear] = process_id;
 }
@@ -80,235 +606,4464 @@ int dequeue(SwapQueue *q) {
     if (q->front == q->rear) {
         q->front = q->rear = -1;
     } else {
-        q->front = (q->front + 1) % MAX_PROCESSES;
+        q->front = (q->front + 1) % q->capacity;
     }
     return item;
 }
 
+// Take process_id out of q wherever it is, keeping the order of the others
+static void queue_remove(SwapQueue *q, int process_id) {
+    int count = queueIsEmpty(q) ? 0 : (q->rear - q->front + q->capacity) % q->capacity + 1;
+    for (int i = 0; i < count; i++) {
+        int item = dequeue(q);
+        if (item != process_id) enqueue(q, item);
+    }
+}
+
 // Helper function implementation
 int get_active_process_count(SystemState *system) {
-    int count = 0;
-    for (int i = 0; i < system->num_processes; i++) {
-        if (system->processes[i].is_active) count++;
+    return system->num_active;
+}
+
+// Close the current interval of the multiprogramming integral. Must be called
+// before every change of num_active or num_finished; time is measured in page
+// accesses.
+static void account_multiprogramming(SystemState *system) {
+    long elapsed = system->page_accesses - system->multiprogramming_since;
+    system->multiprogramming_area += (double)elapsed * (system->num_active - system->num_finished);
+    system->multiprogramming_since = system->page_accesses;
+}
+
+// Time-weighted average number of running (resident, unfinished) processes
+double average_multiprogramming(SystemState *system) {
+    account_multiprogramming(system);
+    if (system->page_accesses == 0) return system->num_active - system->num_finished;
+    return system->multiprogramming_area / system->page_accesses;
+}
+
+// Configuration defaults reproduce the system described in the problem statement
+void init_config(SimConfig *config) {
+    snprintf(config->input_file, MAX_PATH_LEN, "%s", "search.txt");
+    config->user_frames = USER_FRAMES;
+    config->essential_pages = ESSENTIAL_PAGES;
+    config->page_size = PAGE_SIZE;
+    config->data_page_size = 0;
+    config->policy = REPLACE_NONE;
+    config->local_replacement = 0;
+    config->hot_set_size = 0;
+    config->admission = ADMIT_SINGLE;
+    config->frame_report = 0;
+    config->verbosity = DEFAULT_VERBOSITY;
+    config->sample_interval = 0;
+    config->batch_search = 0;
+    memset(&config->storage, 0, sizeof(StorageModel));
+    config->prefetch_depth = 0;
+    config->page_table_levels = 1;
+    config->datasets = 0;
+    memset(&config->tlb, 0, sizeof(TlbModel));
+    config->scheduler = SWAP_FAULTING;
+    config->window = 500;
+}
+
+static const char *policy_names[] = { "none", "fifo", "lru", "clock" };
+
+const char *policy_name(ReplacementPolicy policy) {
+    return policy_names[policy];
+}
+
+// Accepts the names above ("second-chance" is the CLOCK algorithm)
+int parse_policy(const char *name, ReplacementPolicy *policy) {
+    for (int i = 0; i < (int)(sizeof(policy_names) / sizeof(policy_names[0])); i++) {
+        if (strcmp(name, policy_names[i]) == 0) {
+            *policy = (ReplacementPolicy)i;
+            return 0;
+        }
     }
-    return count;
+    if (strcmp(name, "second-chance") == 0) {
+        *policy = REPLACE_CLOCK;
+        return 0;
+    }
+    return -1;
 }
 
-// Main system functions
-void initialize_system(SystemState *system, const char *input_file) {
-    FILE *fp = fopen(input_file, "r");
-    if (!fp) {
-        fprintf(stderr, "Error opening input file\n");
-        exit(1);
+static const char *admission_names[] = { "single", "greedy", "ws" };
+
+const char *admission_name(AdmissionPolicy admission) {
+    return admission_names[admission];
+}
+
+int parse_admission(const char *name, AdmissionPolicy *admission) {
+    for (int i = 0; i < (int)(sizeof(admission_names) / sizeof(admission_names[0])); i++) {
+        if (strcmp(name, admission_names[i]) == 0) {
+            *admission = (AdmissionPolicy)i;
+            return 0;
+        }
     }
+    return -1;
+}
 
-    // Initialize system state
-    memset(system, 0, sizeof(SystemState));
-    initQueue(&system->swap_queue);
+static const char *scheduler_names[] = { "fifo", "ws", "pff" };
+
+const char *scheduler_name(SwapPolicy scheduler) {
+    return scheduler_names[scheduler];
+}
+
+int parse_scheduler(const char *name, SwapPolicy *scheduler) {
+    for (int i = 0; i < (int)(sizeof(scheduler_names) / sizeof(scheduler_names[0])); i++) {
+        if (strcmp(name, scheduler_names[i]) == 0) {
+            *scheduler = (SwapPolicy)i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// A level from 0 (statistics only) to 3 (every fault), or a comma-separated
+// list of categories: events, searches, faults
+int parse_verbosity(const char *name, unsigned *verbosity) {
+    static const unsigned levels[] = { 0, VERBOSE_EVENTS, VERBOSE_EVENTS | VERBOSE_SEARCHES,
+                                       VERBOSE_EVENTS | VERBOSE_SEARCHES | VERBOSE_FAULTS };
+    if (name[0] >= '0' && name[0] <= '3' && name[1] == '\0') {
+        *verbosity = levels[name[0] - '0'];
+        return 0;
+    }
     
-    // Initialize free frames
-    system->num_free_frames = USER_FRAMES;
-    for (int i = 0; i < USER_FRAMES; i++) {
-        system->free_frames[i] = i;
+    char buffer[64];
+    snprintf(buffer, sizeof(buffer), "%s", name);
+    unsigned mask = 0;
+    for (char *item = strtok(buffer, ","); item; item = strtok(NULL, ",")) {
+        if (strcmp(item, "events") == 0) mask |= VERBOSE_EVENTS;
+        else if (strcmp(item, "searches") == 0) mask |= VERBOSE_SEARCHES;
+        else if (strcmp(item, "faults") == 0) mask |= VERBOSE_FAULTS;
+        else if (strcmp(item, "none") != 0) return -1;
+    }
+    *verbosity = mask;
+    return 0;
+}
+
+// "local" or "global" frame allocation for the replacement policy
+int parse_scope(const char *name, int *local_replacement) {
+    if (strcmp(name, "local") == 0 || strcmp(name, "global") == 0) {
+        *local_replacement = name[0] == 'l';
+        return 0;
     }
+    return -1;
+}
+
+// Round a block size up so that the next block stays aligned
+static size_t arena_block(size_t size) {
+    return (size + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN;
+}
+
+// Carve the process array, page tables, free-frame bitmap and queues out
+// of a single zero-filled allocation. calloc() hands large requests straight
+// to the kernel, so untouched page-table entries of a big run never cost
+// more than address space. Search keys stay in the (shared) Trace.
+static int allocate_system(SystemState *system) {
+    size_t n = system->num_processes;
     
-    // Read number of processes and searches per process
-    int num_searches;
-    if (fscanf(fp, "%d %d", &system->num_processes, &num_searches) != 2) {
-        fprintf(stderr, "Error reading process count and search count\n");
-        fclose(fp);
-        exit(1);
+    size_t processes_size = arena_block(n * sizeof(Process));
+    // Flat page tables, or directories and a leaf pool. A leaf backs one
+    // non-empty resident_map word, which holds at least one mapped frame.
+    int two_level = system->num_leaves > 0;
+    size_t page_tables_size = arena_block((two_level ? 0 : n) * PAGE_TABLE_SIZE * sizeof(unsigned short));
+    size_t directory_size = arena_block((two_level ? n : 0) * RESIDENT_WORDS * sizeof(unsigned short *));
+    size_t leaves_size = arena_block((size_t)system->num_leaves * 64 * sizeof(unsigned short));
+    size_t free_leaves_size = arena_block((size_t)system->num_leaves * sizeof(int));
+    
+    // TLB tags and LRU stamps
+    size_t tlb_size = arena_block((size_t)system->tlb.entries * sizeof(uint64_t));
+    size_t stamp_size = arena_block((system->scheduler == SWAP_WORKING_SET ? system->user_frames : 0) * sizeof(long));
+    size_t frame_words = FRAME_WORDS(system->user_frames);
+    size_t frames_size = arena_block(frame_words * sizeof(uint64_t));
+    size_t summary_size = arena_block(FRAME_WORDS(frame_words) * sizeof(uint64_t));
+    size_t units_size = arena_block((system->data_units > 1 ? FRAME_WORDS(system->frames.num_units) : 0) *
+                                    sizeof(uint64_t));
+    size_t queue_size = arena_block(n * sizeof(int));
+    size_t active_size = arena_block(n);
+    size_t field_size = arena_block(n * sizeof(int));
+    size_t resident_size = arena_block(n * RESIDENT_WORDS * sizeof(uint64_t));
+    size_t stats_size = arena_block(n * sizeof(ProcessStats));
+    size_t paths_size = arena_block((system->batch_search ? n : 0) * sizeof(SearchPaths));
+    
+    // Per-frame replacement data: owner, page, two links and a reference bit
+    size_t frames = system->policy != REPLACE_NONE ? system->user_frames : 0;
+    size_t lists = system->policy == REPLACE_NONE ? 0 : system->local_replacement ? n : 1;
+    size_t owner_size = arena_block(frames * sizeof(int));
+    size_t page_size = arena_block(frames * sizeof(unsigned short));
+    size_t links_size = arena_block(frames * sizeof(int));
+    size_t referenced_size = arena_block(frames);
+    size_t lists_size = arena_block(lists * sizeof(FrameList));
+    
+    // Hot sets and their not-yet-accessed bitmaps
+    size_t hot_size = arena_block(n * system->hot_set_size * sizeof(unsigned short));
+    size_t prefetched_size = arena_block((system->hot_set_size ? n : 0) * RESIDENT_WORDS * sizeof(uint64_t));
+    
+    // Read-ahead bitmaps, and arrival times if paging takes time
+    size_t readahead_size = arena_block((system->prefetch_depth ? n : 0) * RESIDENT_WORDS * sizeof(uint64_t));
+    size_t ready_size = arena_block((system->prefetch_depth && system->storage.queue_depth ? system->user_frames : 0) *
+                                    sizeof(long));
+    
+    // Dataset of each process, shared page tables and frame reference counts
+    size_t sharing = system->num_datasets > 0;
+    size_t dataset_size = arena_block(sharing * n * sizeof(int));
+    size_t shared_size = arena_block((size_t)system->num_datasets * PAGE_TABLE_SIZE * sizeof(unsigned short));
+    size_t refs_size = arena_block(sharing * system->user_frames * sizeof(int));
+    
+    size_t arena_size = processes_size + page_tables_size + frames_size + summary_size + units_size + 3 * queue_size +
+                        active_size + 2 * field_size + resident_size + stats_size + paths_size +
+                        owner_size + page_size + 2 * links_size + referenced_size + lists_size +
+                        hot_size + prefetched_size + readahead_size + ready_size +
+                        dataset_size + shared_size + refs_size +
+                        directory_size + leaves_size + free_leaves_size + 2 * tlb_size + stamp_size;
+    char *arena = calloc(1, arena_size);
+    if (!arena) return -1;
+    
+    char *block = arena;
+    system->arena = arena;
+    system->arena_size = arena_size;
+    system->processes = (Process *)block;
+    block += processes_size;
+    unsigned short *page_tables = (unsigned short *)block;
+    block += page_tables_size;
+    system->frames.free_map = (uint64_t *)block;
+    block += frames_size;
+    system->frames.summary = (uint64_t *)block;
+    block += summary_size;
+    system->frames.num_words = frame_words;
+    if (units_size) system->frames.unit_map = (uint64_t *)block;
+    block += units_size;
+    system->swap_queue.items = (int *)block;
+    block += queue_size;
+    system->ready_queue.items = (int *)block;
+    block += queue_size;
+    system->resume_queue.items = (int *)block;
+    block += queue_size;
+    system->is_active = (unsigned char *)block;
+    block += active_size;
+    system->current_search = (int *)block;
+    block += field_size;
+    system->array_size = (int *)block;
+    block += field_size;
+    uint64_t *resident_maps = (uint64_t *)block;
+    block += resident_size;
+    system->process_stats = (ProcessStats *)block;
+    block += stats_size;
+    SearchPaths *paths = (SearchPaths *)block;
+    block += paths_size;
+    
+    if (system->policy != REPLACE_NONE) {
+        system->frame_owner = (int *)block;
+        block += owner_size;
+        system->frame_page = (unsigned short *)block;
+        block += page_size;
+        system->frame_prev = (int *)block;
+        block += links_size;
+        system->frame_next = (int *)block;
+        block += links_size;
+        system->frame_referenced = (unsigned char *)block;
+        block += referenced_size;
+        system->frame_lists = (FrameList *)block;
+        block += lists_size;
+        for (size_t i = 0; i < lists; i++) {
+            system->frame_lists[i].head = system->frame_lists[i].tail = NO_FRAME;
+        }
+    }
+    
+    unsigned short *hot_pages = (unsigned short *)block;
+    block += hot_size;
+    uint64_t *prefetched = (uint64_t *)block;
+    block += prefetched_size;
+    uint64_t *readahead = (uint64_t *)block;
+    block += readahead_size;
+    if (ready_size) system->frame_ready = (long *)block;
+    block += ready_size;
+    if (sharing) {
+        system->dataset = (int *)block;
+        block += dataset_size;
+        system->shared_frames = (unsigned short *)block;
+        block += shared_size;
+        system->frame_refs = (int *)block;
+        block += refs_size;
+    }
+    unsigned short **directories = (unsigned short **)block;
+    block += directory_size;
+    system->leaves = (unsigned short (*)[64])block;
+    block += leaves_size;
+    system->free_leaves = (int *)block;
+    block += free_leaves_size;
+    if (system->tlb.entries) {
+        system->tlb_tags = (uint64_t *)block;
+        block += tlb_size;
+        system->tlb_used = (long *)block;
+        block += tlb_size;
+    }
+    if (stamp_size) system->frame_stamp = (long *)block;
+    for (int i = 0; i < system->num_leaves; i++) {
+        system->free_leaves[i] = system->num_leaves - 1 - i;
+    }
+    system->num_free_leaves = system->num_leaves;
+    
+    for (size_t i = 0; i < n; i++) {
+        if (two_level) {
+            system->processes[i].directory = directories + i * RESIDENT_WORDS;
+        } else {
+            system->processes[i].page_table = page_tables + i * PAGE_TABLE_SIZE;
+        }
+        system->processes[i].resident_map = resident_maps + i * RESIDENT_WORDS;
+        if (system->batch_search) {
+            system->processes[i].paths = paths + i;
+            paths[i].first = -PATH_BATCH;
+        }
+        if (system->hot_set_size) {
+            system->processes[i].hot_pages = hot_pages + i * system->hot_set_size;
+            system->processes[i].prefetched_map = prefetched + i * RESIDENT_WORDS;
+        }
+        if (system->prefetch_depth) {
+            system->processes[i].readahead_map = readahead + i * RESIDENT_WORDS;
+        }
+    }
+    return 0;
+}
+
+void free_system(SystemState *system) {
+    free(system->samples);
+    system->samples = NULL;
+    system->num_samples = system->samples_capacity = 0;
+    free(system->arena);
+    system->arena = NULL;
+    system->processes = NULL;
+    system->frames.free_map = NULL;
+    system->frames.summary = NULL;
+    system->num_processes = 0;
+}
+
+// Parse the next decimal integer of a mapped text file
+static int next_int(const char **pos, const char *end, int *value) {
+    const char *c = *pos;
+    while (c < end && (*c == ' ' || *c == '\t' || *c == '\n' || *c == '\r')) c++;
+    
+    int negative = c < end && *c == '-';
+    if (negative || (c < end && *c == '+')) c++;
+    if (c == end || *c < '0' || *c > '9') return 0;
+    
+    long v = 0;
+    while (c < end && *c >= '0' && *c <= '9') {
+        v = v * 10 + (*c++ - '0');
+        if (v > (long)INT32_MAX + 1) return 0;
     }
+    v = negative ? -v : v;
+    if (v > INT32_MAX || v < INT32_MIN) return 0;
+    
+    *value = (int)v;
+    *pos = c;
+    return 1;
+}
 
-    if (system->num_processes <= 0 || system->num_processes > MAX_PROCESSES ||
-        num_searches <= 0 || num_searches > MAX_SEARCHES) {
+// Validated record count of a trace header
+static int trace_records(int num_processes, int num_searches, size_t *count) {
+    if (num_processes <= 0 || num_searches <= 0) {
         fprintf(stderr, "Invalid number of processes or searches\n");
-        fclose(fp);
-        exit(1);
+        return -1;
+    }
+    if ((size_t)num_searches + 1 > (size_t)-1 / sizeof(int) / (size_t)num_processes) {
+        fprintf(stderr, "Trace of %d x %d searches is too large\n", num_processes, num_searches);
+        return -1;
+    }
+    *count = (size_t)num_processes * ((size_t)num_searches + 1);
+    return 0;
+}
+
+// Tokenize a whole mapped search.txt in one pass
+static int parse_text_trace(Trace *trace, const char *data, size_t size) {
+    const char *pos = data, *end = data + size;
+    
+    // Read number of processes and searches per process
+    if (!next_int(&pos, end, &trace->num_processes) || !next_int(&pos, end, &trace->num_searches)) {
+        fprintf(stderr, "Error reading process count and search count\n");
+        return -1;
     }
+    size_t count;
+    if (trace_records(trace->num_processes, trace->num_searches, &count) != 0) return -1;
     
-    // Initialize each process
-    for (int i = 0; i < system->num_processes; i++) {
-        Process *p = &system->processes[i];
-        memset(p, 0, sizeof(Process));
-        
-        p->num_searches = num_searches;
-        
+    trace->owned = malloc(count * sizeof(int));
+    if (!trace->owned) {
+        fprintf(stderr, "Out of memory for %d processes\n", trace->num_processes);
+        return -1;
+    }
+    
+    int *record = trace->owned;
+    for (int i = 0; i < trace->num_processes; i++, record += trace->num_searches + 1) {
         // Read array size
-        if (fscanf(fp, "%d", &p->array_size) != 1) {
+        if (!next_int(&pos, end, &record[0])) {
             fprintf(stderr, "Error reading array size for process %d\n", i);
-            fclose(fp);
-            exit(1);
+            return -1;
         }
         
         // Read search indices
-        for (int j = 0; j < p->num_searches; j++) {
-            if (fscanf(fp, "%d", &p->search_indices[j]) != 1) {
+        for (int j = 0; j < trace->num_searches; j++) {
+            if (!next_int(&pos, end, &record[j + 1])) {
                 fprintf(stderr, "Error reading search index %d for process %d\n", j, i);
-                fclose(fp);
-                exit(1);
+                return -1;
             }
         }
-        
-        // Initialize page table and allocate essential frames
-        for (int j = 0; j < ESSENTIAL_PAGES && system->num_free_frames > 0; j++) {
-            p->page_table[j] = system->free_frames[--system->num_free_frames] | VALID_BIT_MASK;
-            p->frames_allocated++;
-        }
-        
-        p->current_search = 0;
-        p->is_active = 1;
     }
-    
-    fclose(fp);
-    system->min_active_processes = system->num_processes;
-    
-    printf("+++ Simulation data read from file\n");
-    printf("+++ Kernel data initialized\n");
+    trace->records = trace->owned;
+    return 0;
 }
 
-void swap_out_process(SystemState *system, int process_id) {
-    Process *p = &system->processes[process_id];
-    
-    // Only swap out if process is active
-    if (!p->is_active) return;
+// Load a workload from either a text file (search.txt format) or a binary
+// trace written by write_trace(). Binary traces are used in place from the
+// mapping; text files are parsed straight out of it.
+int load_trace(Trace *trace, const char *file) {
+    memset(trace, 0, sizeof(Trace));
     
-    for (int i = 0; i < PAGE_TABLE_SIZE; i++) {
-        if (p->page_table[i] & VALID_BIT_MASK) {
-            system->free_frames[system->num_free_frames++] = p->page_table[i] & ~VALID_BIT_MASK;
-            p->page_table[i] = 0;
-        }
+    int fd = open(file, O_RDONLY);
+    if (fd == -1) {
+        fprintf(stderr, "Error opening input file %s\n", file);
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        fprintf(stderr, "Error opening input file %s\n", file);
+        close(fd);
+        return -1;
     }
     
-    p->frames_allocated = 0;
-    p->is_active = 0;
-    enqueue(&system->swap_queue, process_id);
-    system->num_swaps++;
+    size_t size = st.st_size;
+    void *data = size ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+    close(fd);
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "Error mapping input file %s\n", file);
+        return -1;
+    }
+    trace->mapping = data;
+    trace->mapping_size = size;
     
-    int active_count = get_active_process_count(system);
-    if (active_count < system->min_active_processes) {
-        system->min_active_processes = active_count;
+    const TraceHeader *header = data;
+    if (size < sizeof(TraceHeader) || memcmp(header->magic, TRACE_MAGIC, sizeof(header->magic)) != 0) {
+        int status = parse_text_trace(trace, data, size);
+        // The parsed records are private, so the text is no longer needed
+        if (data) munmap(data, size);
+        trace->mapping = NULL;
+        if (status != 0) free_trace(trace);
+        return status;
     }
     
-    printf("+++ Swapping out process %3d [%3d active processes]\n", 
-           process_id, active_count);
+    size_t count;
+    trace->num_processes = header->num_processes;
+    trace->num_searches = header->num_searches;
+    if (trace_records(trace->num_processes, trace->num_searches, &count) != 0) {
+        free_trace(trace);
+        return -1;
+    }
+    if ((size - sizeof(TraceHeader)) / sizeof(int) < count) {
+        fprintf(stderr, "Binary trace %s is truncated\n", file);
+        free_trace(trace);
+        return -1;
+    }
+    trace->records = (const int *)(header + 1);
+    return 0;
 }
 
-int handle_page_fault(SystemState *system, int process_id, int page_num) {
-    Process *p = &system->processes[process_id];
-    
-    if (system->num_free_frames > 0) {
-        p->page_table[page_num] = system->free_frames[--system->num_free_frames] | VALID_BIT_MASK;
-        p->frames_allocated++;
-        return 1;
+// Store a workload in the binary trace format
+int write_trace(const Trace *trace, const char *file) {
+    FILE *fp = fopen(file, "wb");
+    if (!fp) {
+        fprintf(stderr, "Error creating trace file %s\n", file);
+        return -1;
     }
     
-    swap_out_process(system, process_id);
+    TraceHeader header;
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.num_processes = trace->num_processes;
+    header.num_searches = trace->num_searches;
+    size_t count = (size_t)trace->num_processes * (trace->num_searches + 1);
+    
+    if (fwrite(&header, sizeof(header), 1, fp) != 1 ||
+        fwrite(trace->records, sizeof(int), count, fp) != count) {
+        fprintf(stderr, "Error writing trace file %s\n", file);
+        fclose(fp);
+        return -1;
+    }
+    if (fclose(fp) != 0) {
+        fprintf(stderr, "Error writing trace file %s\n", file);
+        return -1;
+    }
     return 0;
 }
 
+void free_trace(Trace *trace) {
+    free(trace->owned);
+    if (trace->mapping) munmap(trace->mapping, trace->mapping_size);
+    memset(trace, 0, sizeof(Trace));
+}
 
-void swap_in_process(SystemState *system, int process_id) {
-    Process *p = &system->processes[process_id];
+// Workload given as comma-separated settings, any of which may be left out:
+//     n=200,m=100,size=1000000-2000000,keys=uniform|zipf[:s]|sequential,seed=1
+int parse_workload(const char *spec, Workload *workload) {
+    workload->num_processes = 200;
+    workload->num_searches = 100;
+    workload->min_size = 1000000;
+    workload->max_size = 2000000;
+    workload->keys = KEYS_UNIFORM;
+    workload->zipf_exponent = 1.0;
+    workload->seed = 1;
     
-    // Don't swap in if already active
-    if (p->is_active) return;
-    
-    for (int i = 0; i < ESSENTIAL_PAGES && system->num_free_frames > 0; i++) {
-        p->page_table[i] = system->free_frames[--system->num_free_frames] | VALID_BIT_MASK;
-        p->frames_allocated++;
+    char buffer[256];
+    snprintf(buffer, sizeof(buffer), "%s", spec);
+    for (char *item = strtok(buffer, ","); item; item = strtok(NULL, ",")) {
+        char extra;
+        int low, high;
+        double exponent;
+        unsigned long long seed;
+        if (sscanf(item, "n=%d%c", &low, &extra) == 1) {
+            workload->num_processes = low;
+        } else if (sscanf(item, "m=%d%c", &low, &extra) == 1) {
+            workload->num_searches = low;
+        } else if (sscanf(item, "size=%d-%d%c", &low, &high, &extra) == 2) {
+            workload->min_size = low;
+            workload->max_size = high;
+        } else if (sscanf(item, "size=%d%c", &low, &extra) == 1) {
+            workload->min_size = workload->max_size = low;
+        } else if (strcmp(item, "keys=uniform") == 0) {
+            workload->keys = KEYS_UNIFORM;
+        } else if (strcmp(item, "keys=sequential") == 0) {
+            workload->keys = KEYS_SEQUENTIAL;
+        } else if (strcmp(item, "keys=zipf") == 0) {
+            workload->keys = KEYS_ZIPF;
+        } else if (sscanf(item, "keys=zipf:%lf%c", &exponent, &extra) == 1) {
+            workload->keys = KEYS_ZIPF;
+            workload->zipf_exponent = exponent;
+        } else if (sscanf(item, "seed=%llu%c", &seed, &extra) == 1) {
+            workload->seed = seed;
+        } else {
+            fprintf(stderr, "Invalid workload setting %s\n", item);
+            return -1;
+        }
     }
     
-    p->is_active = 1;
-    system->num_swaps++;
-    
-    printf("+++ Swapping in process %3d [%3d active processes]\n", 
-           process_id, system->min_active_processes);
+    if (workload->min_size <= 0 || workload->max_size < workload->min_size ||
+        workload->zipf_exponent <= 0) {
+        fprintf(stderr, "Invalid workload %s\n", spec);
+        return -1;
+    }
+    return 0;
 }
 
-void simulate_binary_search(SystemState *system, int process_id) {
-    Process *p = &system->processes[process_id];
-    if (!p->is_active || p->current_search >= p->num_searches) return;
-    
-    int search_key = p->search_indices[p->current_search];
-    
-#ifdef VERBOSE
-    printf("\tSearch %d by Process %d\n", p->current_search + 1, process_id);
-#endif
-    
-    int L = 0;
-    int R = p->array_size - 1;
+// Storage model given as comma-separated settings, any of which may be left
+// out: latency in microseconds, bandwidth in MB/s, queue depth, and the CPU
+// time of a page access in nanoseconds
+//     latency=100,bandwidth=500,depth=1,access=100
+int parse_storage(const char *spec, StorageModel *storage) {
+    storage->queue_depth = 1;
+    storage->latency = 100000;
+    storage->bandwidth = 500;
+    storage->access_time = 100;
     
-    while (L < R) {
-        int M = (L + R) / 2;
-        int page_num = (M * 4) / PAGE_SIZE + ESSENTIAL_PAGES;
-        system->page_accesses++;
-        
-        if (!(p->page_table[page_num] & VALID_BIT_MASK)) {
-            system->page_faults++;
-            if (!handle_page_fault(system, process_id, page_num)) {
-                return;
-            }
+    char buffer[256];
+    snprintf(buffer, sizeof(buffer), "%s", spec);
+    for (char *item = strtok(buffer, ","); item; item = strtok(NULL, ",")) {
+        char extra;
+        double latency;
+        long value;
+        if (sscanf(item, "latency=%lf%c", &latency, &extra) == 1 && latency >= 0) {
+            storage->latency = (long)(latency * 1000 + 0.5);
+        } else if (sscanf(item, "bandwidth=%ld%c", &value, &extra) == 1 && value >= 0) {
+            storage->bandwidth = value;
+        } else if (sscanf(item, "depth=%ld%c", &value, &extra) == 1 && value >= 1 &&
+                   value <= MAX_QUEUE_DEPTH) {
+            storage->queue_depth = (int)value;
+        } else if (sscanf(item, "access=%ld%c", &value, &extra) == 1 && value >= 0) {
+            storage->access_time = value;
+        } else {
+            fprintf(stderr, "Invalid storage setting %s\n", item);
+            return -1;
         }
-        
-        if (search_key <= M) {
-            R = M;
+    }
+    return 0;
+}
+
+// TLB given as comma-separated settings, any of which may be left out:
+//     entries=64,ways=4,asid,memory=100
+int parse_tlb(const char *spec, TlbModel *tlb) {
+    tlb->entries = 64;
+    tlb->ways = 4;
+    tlb->asid = 0;
+    tlb->memory_time = 100;
+    
+    char buffer[256];
+    snprintf(buffer, sizeof(buffer), "%s", spec);
+    for (char *item = strtok(buffer, ","); item; item = strtok(NULL, ",")) {
+        char extra;
+        long value;
+        if (sscanf(item, "entries=%ld%c", &value, &extra) == 1 && value >= 1 && value <= 1 << 20) {
+            tlb->entries = (int)value;
+        } else if (sscanf(item, "ways=%ld%c", &value, &extra) == 1 && value >= 1 && value <= 1 << 20) {
+            tlb->ways = (int)value;
+        } else if (strcmp(item, "asid") == 0) {
+            tlb->asid = 1;
+        } else if (sscanf(item, "memory=%ld%c", &value, &extra) == 1 && value >= 0) {
+            tlb->memory_time = value;
         } else {
-            L = M + 1;
+            fprintf(stderr, "Invalid TLB setting %s\n", item);
+            return -1;
         }
     }
     
-    p->current_search++;
+    if (tlb->ways > tlb->entries || tlb->entries % tlb->ways != 0) {
+        fprintf(stderr, "TLB of %d entries cannot have %d ways\n", tlb->entries, tlb->ways);
+        return -1;
+    }
+    return 0;
+}
+
+// splitmix64: the same workload comes out of the same seed everywhere
+static uint64_t next_random(uint64_t *state) {
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+// Uniform in [0, 1)
+static double random_unit(uint64_t *state) {
+    return (next_random(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// Natural logarithm and exponential for the Zipf sampler, so that the
+// simulator still builds without libm
+#define LN2 0.69314718055994530942
+
+static double gen_log(double x) {
+    int exponent = 0;
+    while (x >= 2) { x /= 2; exponent++; }
+    while (x < 1) { x *= 2; exponent--; }
+    
+    // log(x) = 2 atanh((x - 1) / (x + 1)), with x in [1, 2)
+    double t = (x - 1) / (x + 1), t2 = t * t, term = t, sum = 0;
+    for (int k = 1; k < 40; k += 2) {
+        sum += term / k;
+        term *= t2;
+    }
+    return exponent * LN2 + 2 * sum;
+}
+
+static double gen_exp(double x) {
+    int halvings = 0;
+    while (x > 0.5 || x < -0.5) { x /= 2; halvings++; }
     
-    if (p->current_search >= p->num_searches) {
-        // Process finished all searches
-        for (int i = 0; i < PAGE_TABLE_SIZE; i++) {
-            if (p->page_table[i] & VALID_BIT_MASK) {
-                system->free_frames[system->num_free_frames++] = p->page_table[i] & ~VALID_BIT_MASK;
-                p->page_table[i] = 0;
-            }
-        }
-        p->frames_allocated = 0;
-        
-        // Try to swap in processes from queue
-        while (!queueIsEmpty(&system->swap_queue) && system->num_free_frames >= ESSENTIAL_PAGES) {
-            int next_process = dequeue(&system->swap_queue);
-            if (next_process != -1 && !system->processes[next_process].is_active) {
-                swap_in_process(system, next_process);
-            }
-        }
+    double term = 1, sum = 1;
+    for (int k = 1; k < 20; k++) {
+        term *= x / k;
+        sum += term;
     }
+    while (halvings--) sum *= sum;
+    return sum;
 }
 
-void print_statistics(SystemState *system) {
-    printf("+++ Page access summary\n");
-    printf("\tTotal number of page accesses  = %7d\n", system->page_accesses);
-    printf("\tTotal number of page faults    = %7d\n", system->page_faults);
-    printf("\tTotal number of swaps          = %7d\n", system->num_swaps / 2);
-    printf("\tDegree of multiprogramming     = %7d\n", system->min_active_processes);
+// Key in [0, size) drawn from the bounded continuous Zipf (Pareto) law by
+// inversion: rank r >= 1 with density proportional to r^-s
+static int zipf_key(uint64_t *state, int size, double s) {
+    double u = random_unit(state);
+    double rank;
+    if (s > 0.999 && s < 1.001) {
+        rank = gen_exp(u * gen_log(size + 1.0));
+    } else {
+        double top = gen_exp((1 - s) * gen_log(size + 1.0));
+        rank = gen_exp(gen_log((top - 1) * u + 1) / (1 - s));
+    }
+    int key = (int)rank - 1;
+    return key < 0 ? 0 : key >= size ? size - 1 : key;
 }
 
-int main() {
-    SystemState system;
-    initialize_system(&system, "search.txt");
+// Fill a Trace with a synthetic workload, as gensearch would write it
+int generate_trace(Trace *trace, const Workload *workload) {
+    memset(trace, 0, sizeof(Trace));
+    trace->num_processes = workload->num_processes;
+    trace->num_searches = workload->num_searches;
+    size_t count;
+    if (trace_records(trace->num_processes, trace->num_searches, &count) != 0) return -1;
     
-    int active_process = 0;
-    while (1) {
-        int all_done = 1;
-        
-        for (int i = 0; i < system.num_processes; i++) {
-            if (system.processes[i].current_search < system.processes[i].num_searches) {
-                all_done = 0;
-                break;
+    trace->owned = malloc(count * sizeof(int));
+    if (!trace->owned) {
+        fprintf(stderr, "Out of memory for %d processes\n", trace->num_processes);
+        return -1;
+    }
+    
+    uint64_t state = workload->seed;
+    int *record = trace->owned;
+    for (int i = 0; i < trace->num_processes; i++, record += trace->num_searches + 1) {
+        int size = workload->min_size +
+                   (int)(next_random(&state) % ((uint64_t)workload->max_size - workload->min_size + 1));
+        record[0] = size;
+        for (int j = 0; j < trace->num_searches; j++) {
+            switch (workload->keys) {
+                case KEYS_UNIFORM: record[j + 1] = (int)(next_random(&state) % size); break;
+                case KEYS_ZIPF: record[j + 1] = zipf_key(&state, size, workload->zipf_exponent); break;
+                case KEYS_SEQUENTIAL: record[j + 1] = (int)((long)j * size / trace->num_searches); break;
             }
         }
-        
-        if (all_done) break;
-        
-        simulate_binary_search(&system, active_process);
-        active_process = (active_process + 1) % system.num_processes;
     }
-    
-    print_statistics(&system);
+    trace->records = trace->owned;
     return 0;
 }
+
+// Phase timing of a -DPROFILE build. Each thread keeps its own profile;
+// time is charged to the innermost phase only, so the phases add up to the
+// timed part of the run. Other builds compile the markers to nothing.
+//
+// A clock read costs about as much as a page access, so only a random one
+// in PROFILE_SAMPLE searches is timed, with the faults and swaps it leads
+// to. Entries are all counted, and each phase is reported as its mean
+// timed entry times its entries.
+#ifdef PROFILE
+#define PROFILE_SAMPLE 8
+#define PROFILE_UNTIMED -2  // Entered within an untimed search
+#define PROFILE_SKIPPED -3  // An untimed search
+typedef enum { PHASE_SETUP, PHASE_SEARCH, PHASE_FAULT, PHASE_SWAP, PHASE_OUTPUT, NUM_PHASES } ProfilePhase;
+
+static const char *phase_names[NUM_PHASES] = {"setup", "search", "fault", "swap", "output"};
+static const char *phase_labels[NUM_PHASES] = {"Set-up", "Searches", "Fault handling", "Swapping", "Output"};
+
+typedef struct {
+    uint64_t ticks[NUM_PHASES];
+    long entries[NUM_PHASES];
+    long timed[NUM_PHASES];  // Entries that were timed
+    int phase;      // Innermost timed phase, or -1 outside all of them
+    uint64_t mark;  // Clock reading at the last phase change
+    int untimed;    // Inside a search that is not timed
+    uint64_t sampler;
+} Profile;
+
+static __thread Profile profile = {.phase = -1, .sampler = 1};
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PROFILE_UNIT "cycles"
+static inline uint64_t profile_clock(void) {
+    return __builtin_ia32_rdtsc();
+}
+#else
+#define PROFILE_UNIT "ns"
+static inline uint64_t profile_clock(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+#endif
+
+static inline int profile_enter(int phase) {
+    profile.entries[phase]++;
+    if (profile.untimed) return PROFILE_UNTIMED;
+    if (phase == PHASE_SEARCH) {
+        profile.sampler = profile.sampler * 6364136223846793005ULL + 1442695040888963407ULL;
+        if (profile.sampler >> 61 != 0) {
+            profile.untimed = 1;
+            return PROFILE_SKIPPED;
+        }
+    }
+    profile.timed[phase]++;
+    
+    uint64_t now = profile_clock();
+    int outer = profile.phase;
+    if (outer >= 0) profile.ticks[outer] += now - profile.mark;
+    profile.mark = now;
+    profile.phase = phase;
+    return outer;
+}
+
+static inline void profile_leave(int outer) {
+    if (outer == PROFILE_UNTIMED) return;
+    if (outer == PROFILE_SKIPPED) {
+        profile.untimed = 0;
+        return;
+    }
+    uint64_t now = profile_clock();
+    profile.ticks[profile.phase] += now - profile.mark;
+    profile.mark = now;
+    profile.phase = outer;
+}
+
+#define PROFILE_BEGIN(phase) int profile_outer = profile_enter(phase)
+#define PROFILE_END() profile_leave(profile_outer)
+#else
+#define PROFILE_BEGIN(phase) ((void)0)
+#define PROFILE_END() ((void)0)
+#endif
+
+// Write the buffered events out
+static void flush_events(EventRing *ring) {
+    if (ring->count && fwrite(ring->events, sizeof(TraceEvent), ring->count, ring->fp) != (size_t)ring->count) {
+        ring->failed = 1;
+    }
+    ring->count = 0;
+}
+
+// Append an event to the trace; the ring is written out in bulk when full
+static inline void trace_event(SystemState *system, EventType type, int process_id, int arg) {
+    EventRing *ring = system->events;
+    if (__builtin_expect(!ring, 1)) return;
+    
+    TraceEvent *event = &ring->events[ring->count];
+    event->time = system->page_accesses;
+    event->process_id = process_id;
+    event->type_arg = (uint32_t)arg << 8 | type;
+    if (++ring->count == EVENT_RING_SIZE) flush_events(ring);
+}
+
+// Page of the data segment holding A[index]
+static inline int data_page(SystemState *system, int index) {
+    int page = system->page_shift >= 0 ? index >> system->page_shift
+                                       : (int)(((long)index * 4) / system->page_size);
+    return page + system->essential_pages;
+}
+
+// Collect the distinct data pages probed by the top levels of the search
+// tree of p, in breadth-first order. Every search of p starts down this
+// tree, so these are the pages worth restoring after a swap.
+static void compute_hot_set(SystemState *system, int process_id) {
+    Process *p = &system->processes[process_id];
+    int intervals[2 * (4 * HOT_SET_MAX + 1)][2];
+    int head = 0, tail = 0, visited = 0;
+    
+    intervals[tail][0] = 0;
+    intervals[tail++][1] = system->array_size[process_id] - 1;
+    p->num_hot_pages = 0;
+    while (head < tail && p->num_hot_pages < system->hot_set_size && visited++ < 4 * HOT_SET_MAX) {
+        int L = intervals[head][0], R = intervals[head++][1];
+        if (L >= R) continue;
+        
+        int M = L + (R - L) / 2;
+        int page_num = data_page(system, M);
+        int known = 0;
+        for (int i = 0; i < p->num_hot_pages && !known; i++) {
+            known = p->hot_pages[i] == page_num;
+        }
+        if (!known) p->hot_pages[p->num_hot_pages++] = page_num;
+        
+        intervals[tail][0] = L;
+        intervals[tail++][1] = M;
+        intervals[tail][0] = M + 1;
+        intervals[tail++][1] = R;
+    }
+}
+
+// Record the state of memory, then schedule the next sample
+static void take_sample(SystemState *system) {
+    if (system->num_samples == system->samples_capacity) {
+        int capacity = system->samples_capacity ? 2 * system->samples_capacity : 1024;
+        Sample *samples = realloc(system->samples, capacity * sizeof(Sample));
+        if (!samples) {
+            fprintf(stderr, "Out of memory for samples; time series stops at %ld\n", system->page_accesses);
+            system->next_sample = LONG_MAX;
+            return;
+        }
+        system->samples = samples;
+        system->samples_capacity = capacity;
+    }
+    
+    Sample *sample = &system->samples[system->num_samples++];
+    sample->time = system->page_accesses;
+    sample->free_frames = system->num_free_frames;
+    sample->active = system->num_active;
+    sample->running = system->num_active - system->num_finished;
+    sample->swapped = system->num_hosted - system->num_active;
+    system->next_sample = (system->page_accesses / system->sample_interval + 1) * system->sample_interval;
+}
+
+static int compare_ints(const void *a, const void *b) {
+    int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+// The distinct array sizes of a trace, sorted, into a new array *sizes.
+// Returns how many there are, or -1 if out of memory.
+static int distinct_sizes(const Trace *trace, int **sizes) {
+    int *list = malloc(trace->num_processes * sizeof(int));
+    if (!list) return -1;
+    for (int i = 0; i < trace->num_processes; i++) {
+        list[i] = trace->records[(size_t)i * (trace->num_searches + 1)];
+    }
+    qsort(list, trace->num_processes, sizeof(int), compare_ints);
+    
+    int count = 0;
+    for (int i = 0; i < trace->num_processes; i++) {
+        if (count == 0 || list[i] != list[count - 1]) list[count++] = list[i];
+    }
+    *sizes = list;
+    return count;
+}
+
+// Main system functions. The trace must outlive the system state.
+int initialize_system(SystemState *system, const SimConfig *config, const Trace *trace) {
+    return initialize_node(system, config, trace, 0, trace->num_processes);
+}
+
+// Set up a memory node hosting processes first .. first + count - 1 of the
+// trace. Every process of the trace gets a slot, so that others can migrate
+// in later; the ones not hosted are neither scheduled nor given frames.
+int initialize_node(SystemState *system, const SimConfig *config, const Trace *trace, int first, int count) {
+    if (config->user_frames <= 0 || config->user_frames > MAX_FRAMES ||
+        config->essential_pages <= 0 || config->essential_pages >= PAGE_TABLE_SIZE ||
+        config->page_size < 4 || config->page_size % 4 != 0 ||
+        config->data_page_size < 0 || (config->data_page_size && (config->data_page_size % config->page_size != 0 ||
+        (config->data_page_size / config->page_size & (config->data_page_size / config->page_size - 1)) ||
+        config->data_page_size / config->page_size > config->user_frames)) ||
+        config->hot_set_size < 0 || config->hot_set_size > HOT_SET_MAX ||
+        config->prefetch_depth < 0 || config->prefetch_depth > MAX_PROBES ||
+        config->datasets < SHARE_BY_SIZE || config->page_table_levels < 1 || config->page_table_levels > 2 ||
+        config->window <= 0) {
+        fprintf(stderr, "Invalid configuration for %s\n", config->input_file);
+        return -1;
+    }
+    if (config->datasets && config->scheduler == SWAP_WORKING_SET) {
+        // Working sets are tracked per frame, and a shared frame has several owners
+        fprintf(stderr, "Shared data pages cannot be combined with working-set scheduling\n");
+        return -1;
+    }
+    if (config->datasets && config->data_page_size > config->page_size) {
+        fprintf(stderr, "Shared data pages must be a single frame\n");
+        return -1;
+    }
+    if (config->datasets && config->policy != REPLACE_NONE) {
+        // A shared frame would have to be unmapped from every sharer
+        fprintf(stderr, "Shared data pages cannot be combined with page replacement\n");
+        return -1;
+    }
+
+    // Initialize system state (the output streams are chosen by the caller)
+    FILE *out = system->out;
+    EventRing *events = system->events;
+    memset(system, 0, sizeof(SystemState));
+    system->out = out;
+    system->events = events;
+    system->key_mask = -1;
+    system->verbosity = config->verbosity;
+    system->sample_interval = config->sample_interval;
+    system->next_sample = LONG_MAX;
+    system->user_frames = config->user_frames;
+    system->essential_pages = config->essential_pages;
+    system->page_size = config->data_page_size ? config->data_page_size : config->page_size;
+    system->data_units = system->page_size / config->page_size;
+    system->frames.num_units = system->user_frames / system->data_units;
+    system->policy = config->policy;
+    system->local_replacement = config->local_replacement;
+    system->hot_set_size = config->hot_set_size;
+    system->admission = config->admission;
+    system->frame_report = config->frame_report;
+    system->prefetch_depth = config->prefetch_depth;
+    system->tlb = config->tlb;
+    if (system->tlb.entries) {
+        system->tlb_sets = system->tlb.entries / system->tlb.ways;
+        system->tlb_process = -1;
+        system->tlb_walk_levels = config->page_table_levels;
+    }
+    system->scheduler = config->scheduler;
+    system->window = config->window;
+    system->track_hits = system->policy != REPLACE_NONE || system->hot_set_size > 0 || system->prefetch_depth > 0 ||
+                         system->tlb.entries > 0 || system->scheduler == SWAP_WORKING_SET;
+    system->page_shift = -1;
+    for (int shift = 0; shift < 30; shift++) {
+        if ((4L << shift) == system->page_size) system->page_shift = shift;
+    }
+    system->batch_search = config->batch_search && system->page_shift >= 0;
+    system->storage = config->storage;
+    if (system->storage.bandwidth > 0) {
+        // Bytes at MB/s take 1000 ns per byte per MB/s
+        system->page_transfer = ((long)config->page_size * 1000 + system->storage.bandwidth / 2) /
+                                system->storage.bandwidth;
+    }
+    system->num_processes = trace->num_processes;
+    system->num_searches = trace->num_searches;
+    
+    // The data segment of every process must fit in the virtual address space
+    const int *record = trace->records;
+    for (int i = 0; i < trace->num_processes; i++, record += trace->num_searches + 1) {
+        if (record[0] <= 0 ||
+            ((long)(record[0] - 1) * 4) / system->page_size + system->essential_pages >= PAGE_TABLE_SIZE) {
+            fprintf(stderr, "Array of process %d does not fit in %d pages\n", i, PAGE_TABLE_SIZE);
+            return -1;
+        }
+    }
+    
+    int *sizes = NULL;
+    if (config->datasets == SHARE_BY_SIZE) {
+        system->num_datasets = distinct_sizes(trace, &sizes);
+        if (system->num_datasets < 0) {
+            fprintf(stderr, "Out of memory for %d processes\n", system->num_processes);
+            return -1;
+        }
+    } else if (config->datasets > 0) {
+        system->num_datasets = config->datasets < system->num_processes ? config->datasets
+                                                                        : system->num_processes;
+    }
+    
+    if (config->page_table_levels == 2) {
+        // Without sharing, every leaf in use holds a frame of its own
+        long leaves = (long)system->num_processes * RESIDENT_WORDS;
+        if (!system->num_datasets && leaves > system->user_frames) leaves = system->user_frames;
+        system->num_leaves = (int)leaves;
+    }
+    
+    if (allocate_system(system) != 0) {
+        fprintf(stderr, "Out of memory for %d processes\n", system->num_processes);
+        free(sizes);
+        return -1;
+    }
+    initQueue(&system->swap_queue, system->swap_queue.items, system->num_processes);
+    initQueue(&system->ready_queue, system->ready_queue.items, system->num_processes);
+    initQueue(&system->resume_queue, system->resume_queue.items, system->num_processes);
+    
+    // Initialize free frames
+    FramePool *pool = &system->frames;
+    for (int w = 0; w < pool->num_words; w++) {
+        int bits = system->user_frames - w * 64;
+        pool->free_map[w] = bits >= 64 ? ~(uint64_t)0 : ((uint64_t)1 << bits) - 1;
+        pool->summary[w / 64] |= (uint64_t)1 << (w % 64);
+    }
+    system->num_free_frames = system->user_frames;
+    if (pool->unit_map) {
+        for (int u = 0; u < pool->num_units; u++) pool->unit_map[u / 64] |= (uint64_t)1 << (u % 64);
+        pool->free_units = pool->num_units;
+    }
+    
+    // Initialize each process (the arena is zero-filled)
+    record = trace->records;
+    for (int i = 0; i < system->num_processes; i++, record += trace->num_searches + 1) {
+        Process *p = &system->processes[i];
+        
+        system->array_size[i] = record[0];
+        p->search_indices = record + 1;
+        if (sizes) {
+            system->dataset[i] = (int *)bsearch(&record[0], sizes, system->num_datasets, sizeof(int),
+                                                compare_ints) - sizes;
+        } else if (system->num_datasets) {
+            system->dataset[i] = i % system->num_datasets;
+        }
+        
+        if (system->hot_set_size) {
+            compute_hot_set(system, i);
+        }
+        if (i < first || i >= first + count) continue;
+        long data_pages = ((long)(record[0] - 1) * 4) / system->page_size + 1;
+        system->data_bytes += data_pages * system->page_size;
+        system->data_slack += data_pages * system->page_size - (long)record[0] * 4;
+        
+        // Initialize page table and allocate essential frames
+        map_essential_pages(system, p);
+        system->is_active[i] = 1;
+        enqueue(&system->ready_queue, i);
+    }
+    
+    free(sizes);
+    system->num_hosted = count;
+    system->min_active_processes = count;
+    system->num_active = count;
+    
+    if (system->sample_interval > 0) take_sample(system);
+    trace_event(system, EVENT_INIT, -1, 0);
+    if (system->verbosity & VERBOSE_EVENTS) {
+        fprintf(system->out, "+++ Simulation data read from file\n");
+        fprintf(system->out, "+++ Kernel data initialized\n");
+    }
+    return 0;
+}
+
+// Replacement list holding the frames of process_id
+static inline FrameList *frame_list(SystemState *system, int process_id) {
+    return &system->frame_lists[system->local_replacement ? process_id : 0];
+}
+
+static void link_frame(SystemState *system, FrameList *list, int frame) {
+    system->frame_prev[frame] = list->tail;
+    system->frame_next[frame] = NO_FRAME;
+    if (list->tail == NO_FRAME) {
+        list->head = frame;
+    } else {
+        system->frame_next[list->tail] = frame;
+    }
+    list->tail = frame;
+}
+
+static void unlink_frame(SystemState *system, FrameList *list, int frame) {
+    int prev = system->frame_prev[frame], next = system->frame_next[frame];
+    if (prev == NO_FRAME) {
+        list->head = next;
+    } else {
+        system->frame_next[prev] = next;
+    }
+    if (next == NO_FRAME) {
+        list->tail = prev;
+    } else {
+        system->frame_prev[next] = prev;
+    }
+}
+
+// Record a hit on a resident data page for the policies that need it
+static void touch_frame(SystemState *system, int process_id, int frame) {
+    if (system->policy == REPLACE_LRU) {
+        FrameList *list = frame_list(system, process_id);
+        if (list->tail != frame) {
+            unlink_frame(system, list, frame);
+            link_frame(system, list, frame);
+        }
+    } else if (system->policy == REPLACE_CLOCK) {
+        system->frame_referenced[frame] = 1;
+    }
+}
+
+// TLB operations. A page is translated through the TLB on every access; a
+// miss walks the page table and refills the least recently used way.
+static inline uint64_t tlb_tag(const SystemState *system, int process_id, int page_num) {
+    return (system->tlb.asid ? (uint64_t)process_id << 16 : 0) + page_num + 1;
+}
+
+static void tlb_access(SystemState *system, int process_id, int page_num) {
+    uint64_t tag = tlb_tag(system, process_id, page_num);
+    int first = page_num % system->tlb_sets * system->tlb.ways;
+    uint64_t *tags = system->tlb_tags + first;
+    long *used = system->tlb_used + first;
+    system->tlb_clock++;
+    
+    int victim = 0;
+    for (int way = 0; way < system->tlb.ways; way++) {
+        if (tags[way] == tag) {
+            used[way] = system->tlb_clock;
+            system->tlb_hits++;
+            return;
+        }
+        if (used[way] < used[victim]) victim = way;
+    }
+    tags[victim] = tag;
+    used[victim] = system->tlb_clock;
+    system->tlb_misses++;
+}
+
+// Drop the translation of one page, if it is cached
+static void tlb_invalidate(SystemState *system, int process_id, int page_num) {
+    if (!system->tlb_sets || (!system->tlb.asid && process_id != system->tlb_process)) return;
+    uint64_t tag = tlb_tag(system, process_id, page_num);
+    int first = page_num % system->tlb_sets * system->tlb.ways;
+    for (int way = 0; way < system->tlb.ways; way++) {
+        if (system->tlb_tags[first + way] == tag) {
+            system->tlb_tags[first + way] = 0;
+            system->tlb_used[first + way] = 0;
+        }
+    }
+}
+
+static void tlb_flush(SystemState *system) {
+    memset(system->tlb_tags, 0, system->tlb.entries * sizeof(uint64_t));
+    memset(system->tlb_used, 0, system->tlb.entries * sizeof(long));
+    system->tlb_flushes++;
+}
+
+// Drop every translation of process_id: with ASIDs its entries only, else
+// the whole TLB if it holds that process
+static void tlb_flush_process(SystemState *system, int process_id) {
+    if (!system->tlb_sets) return;
+    if (!system->tlb.asid) {
+        if (process_id == system->tlb_process) {
+            tlb_flush(system);
+            system->tlb_process = -1;
+        }
+        return;
+    }
+    for (int i = 0; i < system->tlb.entries; i++) {
+        if (system->tlb_tags[i] && (int)((system->tlb_tags[i] - 1) >> 16) == process_id) {
+            system->tlb_tags[i] = 0;
+            system->tlb_used[i] = 0;
+        }
+    }
+}
+
+// Page table operations. A page is valid if the valid bit of its entry is
+// set. The resident bitmap marks the same pages, but only serves to find
+// them without scanning the table.
+static inline int page_valid(const Process *p, int page_num) {
+    if (p->page_table) return p->page_table[page_num] & VALID_BIT_MASK;
+    const unsigned short *leaf = p->directory[page_num / 64];
+    return leaf && leaf[page_num % 64] & VALID_BIT_MASK;
+}
+
+// Frame of valid page page_num
+static inline int page_frame(const Process *p, int page_num) {
+    const unsigned short *entry = p->page_table ? &p->page_table[page_num]
+                                                : &p->directory[page_num / 64][page_num % 64];
+    return *entry & ~VALID_BIT_MASK;
+}
+
+// Enter frame for page page_num, called before the page is marked resident
+static inline void set_page_frame(SystemState *system, Process *p, int page_num, int frame) {
+    if (p->page_table) {
+        p->page_table[page_num] = frame | VALID_BIT_MASK;
+        return;
+    }
+    unsigned short **leaf = &p->directory[page_num / 64];
+    if (!*leaf) {
+        *leaf = system->leaves[system->free_leaves[--system->num_free_leaves]];
+        if (system->num_leaves - system->num_free_leaves > system->peak_leaves) {
+            system->peak_leaves = system->num_leaves - system->num_free_leaves;
+        }
+    }
+    (*leaf)[page_num % 64] = frame | VALID_BIT_MASK;
+}
+
+// Remove page page_num, called once it is no longer marked resident. A leaf
+// left without resident pages goes back to the pool.
+static inline void clear_page_frame(SystemState *system, Process *p, int page_num) {
+    if (p->page_table) {
+        p->page_table[page_num] = 0;
+        return;
+    }
+    int w = page_num / 64;
+    p->directory[w][page_num % 64] = 0;
+    if (!p->resident_map[w]) {
+        system->free_leaves[system->num_free_leaves++] = (p->directory[w] - system->leaves[0]) / 64;
+        p->directory[w] = NULL;
+    }
+}
+
+// Current simulated time
+static inline long storage_clock(const SystemState *system) {
+    return system->page_accesses * system->storage.access_time + system->io_stall;
+}
+
+// Submit a request moving pages pages to or from the swap device, and return
+// its completion time. Each request waits for a free queue slot and its
+// latency, then for the data path, which serves one transfer at a time.
+// Requests do not stall the CPU; storage_wait() does.
+static long storage_request(SystemState *system, int pages, int is_read) {
+    if (system->storage.queue_depth == 0 || pages == 0) return 0;
+    
+    long now = storage_clock(system);
+    int slot = 0;
+    for (int i = 1; i < system->storage.queue_depth; i++) {
+        if (system->channel_free[i] < system->channel_free[slot]) slot = i;
+    }
+    long start = now > system->channel_free[slot] ? now : system->channel_free[slot];
+    long transfer = start + system->storage.latency;
+    if (transfer < system->bus_free) transfer = system->bus_free;
+    long done = transfer + pages * system->page_transfer;
+    system->bus_free = system->channel_free[slot] = done;
+    
+    // Requests arrive in time order, so the busy time is a running union
+    if (done > system->busy_until) {
+        system->device_busy += done - (start > system->busy_until ? start : system->busy_until);
+        system->busy_until = done;
+    }
+    
+    if (is_read) {
+        system->pages_read += pages;
+    } else {
+        system->pages_written += pages;
+    }
+    return done;
+}
+
+// Stall the CPU until time done, pending page accesses not yet counted
+static inline void storage_wait(SystemState *system, long done, long pending) {
+    long now = storage_clock(system) + pending * system->storage.access_time;
+    if (done > now) system->io_stall += done - now;
+}
+
+// Bookkeeping for a page hit: replacement order, hot-set and read-ahead
+// usage. pending is the accesses of the search not yet counted.
+static void note_hit(SystemState *system, int process_id, Process *p, int page_num, long pending) {
+    if (system->tlb_sets) tlb_access(system, process_id, page_num);
+    
+    int frame = page_frame(p, page_num);
+    if (system->policy != REPLACE_NONE) {
+        touch_frame(system, process_id, frame);
+    }
+    if (system->frame_stamp) {
+        system->frame_stamp[frame] = system->process_stats[process_id].page_accesses + pending;
+    }
+    
+    uint64_t bit = (uint64_t)1 << (page_num % 64);
+    if (system->hot_set_size && (p->prefetched_map[page_num / 64] & bit)) {
+        p->prefetched_map[page_num / 64] &= ~bit;
+        system->hot_faults_saved++;
+    }
+    if (system->prefetch_depth && (p->readahead_map[page_num / 64] & bit)) {
+        // A read-ahead page may still be on its way
+        p->readahead_map[page_num / 64] &= ~bit;
+        system->prefetch_used++;
+        if (system->frame_ready) {
+            long before = system->io_stall;
+            storage_wait(system, system->frame_ready[frame], pending);
+            system->prefetch_late += system->io_stall != before;
+        }
+    }
+}
+
+// Unit bookkeeping for data pages of several frames: a unit stops being
+// free when any of its frames is taken, and is free again once all are back
+static inline void unit_taken(FramePool *pool, int units, int frame) {
+    int u = frame / units;
+    if (u < pool->num_units && (pool->unit_map[u / 64] >> (u % 64) & 1)) {
+        pool->unit_map[u / 64] &= ~((uint64_t)1 << (u % 64));
+        pool->free_units--;
+    }
+}
+
+static void unit_returned(FramePool *pool, int units, int frame) {
+    int u = frame / units;
+    if (u >= pool->num_units) return;
+    int first = u * units;
+    if (units < 64) {
+        uint64_t mask = (((uint64_t)1 << units) - 1) << (first % 64);
+        if ((pool->free_map[first / 64] & mask) != mask) return;
+    } else {
+        for (int w = first / 64; w < (first + units) / 64; w++) {
+            if (~pool->free_map[w]) return;
+        }
+    }
+    pool->unit_map[u / 64] |= (uint64_t)1 << (u % 64);
+    pool->free_units++;
+}
+
+// Take the lowest free frame (a free frame must exist)
+static inline int take_frame(SystemState *system) {
+    FramePool *pool = &system->frames;
+    int s = 0;
+    while (!pool->summary[s]) s++;
+    int w = s * 64 + __builtin_ctzll(pool->summary[s]);
+    int frame = w * 64 + __builtin_ctzll(pool->free_map[w]);
+    
+    pool->free_map[w] &= pool->free_map[w] - 1;
+    if (!pool->free_map[w]) pool->summary[s] &= ~((uint64_t)1 << (w % 64));
+    system->num_free_frames--;
+    if (pool->unit_map) unit_taken(pool, system->data_units, frame);
+    return frame;
+}
+
+static inline void put_frame(SystemState *system, int frame) {
+    FramePool *pool = &system->frames;
+    int w = frame / 64;
+    pool->free_map[w] |= (uint64_t)1 << (frame % 64);
+    pool->summary[w / 64] |= (uint64_t)1 << (w % 64);
+    system->num_free_frames++;
+    if (pool->unit_map) unit_returned(pool, system->data_units, frame);
+}
+
+// First frame of the lowest run of count free frames, or -1. Also counts
+// the runs of free frames met on the way into *extents when it is not NULL
+// (the whole bitmap is then scanned).
+static int find_free_run(FramePool *pool, int count, long *extents) {
+    int found = -1;
+    int run_start = 0, run_len = 0;
+    for (int w = 0; w < pool->num_words; w++) {
+        uint64_t bits = pool->free_map[w];
+        if (extents) {
+            // A run starts at a free frame whose predecessor is taken
+            uint64_t carry = (w > 0 && (pool->free_map[w - 1] >> 63)) ? 1 : 0;
+            *extents += __builtin_popcountll(bits & ~((bits << 1) | carry));
+        }
+        if (found >= 0) {
+            if (!extents) break;
+            continue;
+        }
+        
+        int bit = 0;
+        while (bit < 64) {
+            uint64_t rest = bits >> bit;
+            if (!rest) {
+                run_len = 0;
+                break;
+            }
+            int zeros = __builtin_ctzll(rest);
+            if (zeros) {
+                run_len = 0;
+                bit += zeros;
+                rest >>= zeros;
+            }
+            int ones = ~rest ? __builtin_ctzll(~rest) : 64;
+            if (run_len == 0) run_start = w * 64 + bit;
+            run_len += ones;
+            bit += ones;
+            if (run_len >= count) {
+                found = run_start;
+                break;
+            }
+            if (bit < 64) run_len = 0;
+        }
+    }
+    return found;
+}
+
+// Take the count frames starting at first, all of them free
+static void take_frame_run(SystemState *system, int first, int count) {
+    FramePool *pool = &system->frames;
+    for (int frame = first; frame < first + count; ) {
+        int w = frame / 64;
+        int bits = 64 - frame % 64 < first + count - frame ? 64 - frame % 64 : first + count - frame;
+        uint64_t mask = (bits == 64 ? ~(uint64_t)0 : ((uint64_t)1 << bits) - 1) << (frame % 64);
+        pool->free_map[w] &= ~mask;
+        if (!pool->free_map[w]) pool->summary[w / 64] &= ~((uint64_t)1 << (w % 64));
+        frame += bits;
+    }
+    system->num_free_frames -= count;
+    if (pool->unit_map) {
+        for (int frame = first; frame < first + count; frame += system->data_units) {
+            unit_taken(pool, system->data_units, frame);
+        }
+        unit_taken(pool, system->data_units, first + count - 1);
+    }
+}
+
+// First frame of the lowest free unit, which is taken
+static int take_unit(SystemState *system) {
+    FramePool *pool = &system->frames;
+    int w = 0;
+    while (!pool->unit_map[w]) w++;
+    int first = (w * 64 + __builtin_ctzll(pool->unit_map[w])) * system->data_units;
+    take_frame_run(system, first, system->data_units);
+    return first;
+}
+
+// Return the unit starting at first
+static void put_unit(SystemState *system, int first) {
+    FramePool *pool = &system->frames;
+    for (int frame = first; frame < first + system->data_units; frame++) {
+        pool->free_map[frame / 64] |= (uint64_t)1 << (frame % 64);
+        pool->summary[frame / 64 / 64] |= (uint64_t)1 << (frame / 64 % 64);
+    }
+    system->num_free_frames += system->data_units;
+    unit_returned(pool, system->data_units, first);
+}
+
+// Frames of page page_num
+static inline int page_frames(const SystemState *system, int page_num) {
+    return page_num >= system->essential_pages ? system->data_units : 1;
+}
+
+// Whether a data page can be mapped without evicting or swapping
+static inline int data_frame_free(const SystemState *system) {
+    return system->data_units == 1 ? system->num_free_frames > 0 : system->frames.free_units > 0;
+}
+
+// Give back the frames of page page_num, starting at frame
+static inline void put_page_frames(SystemState *system, int page_num, int frame) {
+    if (page_frames(system, page_num) > 1) {
+        put_unit(system, frame);
+    } else {
+        put_frame(system, frame);
+    }
+}
+
+// Give frame to page page_num of p
+static void map_frame(SystemState *system, Process *p, int page_num, int frame) {
+    set_page_frame(system, p, page_num, frame);
+    p->resident_map[page_num / 64] |= (uint64_t)1 << (page_num % 64);
+    p->resident_words |= (uint32_t)1 << (page_num / 64);
+    p->frames_allocated += page_frames(system, page_num);
+    
+    int process_id = p - system->processes;
+    if (p->frames_allocated > system->process_stats[process_id].peak_frames) {
+        system->process_stats[process_id].peak_frames = p->frames_allocated;
+    }
+    
+    if (system->frame_stamp) system->frame_stamp[frame] = system->process_stats[process_id].page_accesses;
+    if (system->policy != REPLACE_NONE && page_num >= system->essential_pages) {
+        system->frame_owner[frame] = process_id;
+        system->frame_page[frame] = page_num;
+        system->frame_referenced[frame] = 0;
+        link_frame(system, frame_list(system, process_id), frame);
+    }
+}
+
+// Frame of data page page_num that the dataset of process_id has resident,
+// or -1. Always -1 unless data pages are shared.
+static inline int shared_frame(const SystemState *system, int process_id, int page_num) {
+    if (!system->shared_frames || page_num < system->essential_pages) return -1;
+    unsigned short entry = system->shared_frames[(size_t)system->dataset[process_id] * PAGE_TABLE_SIZE + page_num];
+    return entry & VALID_BIT_MASK ? entry & ~VALID_BIT_MASK : -1;
+}
+
+// Give page page_num of p its frame: the one its dataset already has for a
+// shared data page, else the next free frame (which must exist)
+void map_page(SystemState *system, Process *p, int page_num) {
+    int process_id = p - system->processes;
+    int frame = shared_frame(system, process_id, page_num);
+    if (frame >= 0) {
+        system->frame_refs[frame]++;
+        if (++system->shared_mappings > system->peak_shared_mappings) {
+            system->peak_shared_mappings = system->shared_mappings;
+        }
+    } else {
+        frame = page_frames(system, page_num) > 1 ? take_unit(system) : take_frame(system);
+        if (system->shared_frames && page_num >= system->essential_pages) {
+            system->shared_frames[(size_t)system->dataset[process_id] * PAGE_TABLE_SIZE + page_num] =
+                frame | VALID_BIT_MASK;
+            system->frame_refs[frame] = 1;
+        }
+    }
+    map_frame(system, p, page_num, frame);
+}
+
+// Map the essential pages of p as one batch: from a single run of
+// contiguous frames if there is one, else from the lowest free frames
+void map_essential_pages(SystemState *system, Process *p) {
+    FramePool *pool = &system->frames;
+    int count = system->essential_pages < system->num_free_frames ? system->essential_pages
+                                                                   : system->num_free_frames;
+    if (count == 0) return;
+    
+    int first = find_free_run(pool, count, system->frame_report ? &pool->free_extents : NULL);
+    pool->batches++;
+    if (first >= 0) {
+        take_frame_run(system, first, count);
+        for (int i = 0; i < count; i++) {
+            map_frame(system, p, i, first + i);
+        }
+        pool->contiguous_batches++;
+    } else {
+        for (int i = 0; i < count; i++) {
+            map_page(system, p, i);
+        }
+    }
+}
+
+// Return every frame of p to the free list. Only the resident pages are
+// visited, in increasing page order, through the two bitmap levels.
+void release_pages(SystemState *system, Process *p) {
+    tlb_flush_process(system, p - system->processes);
+    uint32_t words = p->resident_words;
+    while (words) {
+        int w = __builtin_ctz(words);
+        words &= words - 1;
+        
+        uint64_t bits = p->resident_map[w];
+        while (bits) {
+            int page_num = w * 64 + __builtin_ctzll(bits);
+            bits &= bits - 1;
+            if (!page_valid(p, page_num)) {
+                fprintf(stderr, "Page %d of process %d is resident without a valid entry\n", page_num,
+                        (int)(p - system->processes));
+                continue;
+            }
+            int frame = page_frame(p, page_num);
+            if (system->policy != REPLACE_NONE && page_num >= system->essential_pages) {
+                unlink_frame(system, frame_list(system, p - system->processes), frame);
+            }
+            if (p->page_table) p->page_table[page_num] = 0;
+            if (system->shared_frames && page_num >= system->essential_pages) {
+                // A shared frame goes back with its last user
+                if (--system->frame_refs[frame] > 0) {
+                    system->shared_mappings--;
+                    continue;
+                }
+                system->shared_frames[(size_t)system->dataset[p - system->processes] * PAGE_TABLE_SIZE +
+                                      page_num] = 0;
+            }
+            put_page_frames(system, page_num, frame);
+        }
+        p->resident_map[w] = 0;
+        if (p->directory) {
+            // The whole leaf is cleared before it goes back to the pool
+            memset(p->directory[w], 0, 64 * sizeof(unsigned short));
+            clear_page_frame(system, p, w * 64);
+        }
+    }
+    p->resident_words = 0;
+    p->frames_allocated = 0;
+    
+    // Restored pages that were never accessed are simply dropped
+    if (system->hot_set_size) {
+        memset(p->prefetched_map, 0, RESIDENT_WORDS * sizeof(uint64_t));
+    }
+    if (system->prefetch_depth) {
+        for (int w = 0; w < RESIDENT_WORDS; w++) {
+            system->prefetch_wasted += __builtin_popcountll(p->readahead_map[w]);
+            p->readahead_map[w] = 0;
+        }
+    }
+}
+
+// Essential pages plus the data pages process_id used in its last window
+// accesses (SWAP_WORKING_SET)
+static int working_set_size(const SystemState *system, int process_id) {
+    const Process *p = &system->processes[process_id];
+    long since = system->process_stats[process_id].page_accesses - system->window;
+    int size = system->essential_pages;
+    for (int w = 0; w < RESIDENT_WORDS; w++) {
+        uint64_t bits = p->resident_map[w];
+        if (w == 0) bits &= system->essential_pages >= 64 ? 0 : ~(uint64_t)0 << system->essential_pages;
+        while (bits) {
+            int page_num = w * 64 + __builtin_ctzll(bits);
+            bits &= bits - 1;
+            if (page_num >= system->essential_pages && system->frame_stamp[page_frame(p, page_num)] >= since) {
+                size += system->data_units;
+            }
+        }
+    }
+    return size;
+}
+
+// Process to swap out when process_id faults and no frame can be found:
+// among the running processes, under SWAP_WORKING_SET the one with the
+// most resident pages outside its working set (then the most frames), under
+// SWAP_PFF the one faulting most often (then the most frames). Ties go to
+// process_id, then to the lowest id.
+static int choose_swap_victim(SystemState *system, int process_id) {
+    if (system->scheduler == SWAP_FAULTING) return process_id;
+    
+    int victim = -1;
+    long best = 0, best_frames = 0;
+    for (int n = 0; n <= system->num_processes; n++) {
+        int i = n == 0 ? process_id : n - 1;
+        if (n > 0 && i == process_id) continue;
+        Process *p = &system->processes[i];
+        if (!system->is_active[i] || system->current_search[i] >= system->num_searches || p->frames_allocated == 0) {
+            continue;
+        }
+        long key = system->scheduler == SWAP_WORKING_SET ? p->frames_allocated - working_set_size(system, i)
+                                                          : p->window_faults + p->recent_faults;
+        if (victim == -1 || key > best || (key == best && p->frames_allocated > best_frames)) {
+            victim = i;
+            best = key;
+            best_frames = p->frames_allocated;
+        }
+    }
+    return victim == -1 ? process_id : victim;
+}
+
+// Count a fault in the fault-frequency window of process_id (SWAP_PFF)
+static void note_fault_frequency(SystemState *system, int process_id) {
+    Process *p = &system->processes[process_id];
+    long now = system->process_stats[process_id].page_accesses;
+    if (now - p->window_start >= system->window) {
+        p->recent_faults = now - p->window_start >= 2 * system->window ? 0 : p->window_faults;
+        p->window_faults = 0;
+        p->window_start = now;
+    }
+    p->window_faults++;
+}
+
+void swap_out_process(SystemState *system, int process_id) {
+    Process *p = &system->processes[process_id];
+    
+    // Only swap out if process is active
+    if (!system->is_active[process_id]) return;
+    
+    // The frames it held were not enough: that is its working set estimate,
+    // unless the working set is tracked
+    if (system->scheduler == SWAP_WORKING_SET) {
+        p->working_set = working_set_size(system, process_id);
+    } else {
+        p->working_set = p->frames_allocated + system->data_units;
+    }
+    p->fault_frequency = p->window_faults + p->recent_faults;
+    
+    // Remember which hot pages to bring back with the essential ones
+    p->restore_mask = 0;
+    for (int i = 0; i < p->num_hot_pages; i++) {
+        if (page_valid(p, p->hot_pages[i])) {
+            p->restore_mask |= (uint64_t)1 << i;
+        }
+    }
+    
+    // The whole resident set goes out to the swap area
+    storage_request(system, p->frames_allocated, 0);
+    release_pages(system, p);
+    
+    account_multiprogramming(system);
+    system->is_active[process_id] = 0;
+    system->num_active--;
+    system->process_stats[process_id].swap_outs++;
+    enqueue(&system->swap_queue, process_id);
+    system->num_swaps++;
+    
+    int active_count = get_active_process_count(system);
+    if (active_count < system->min_active_processes) {
+        system->min_active_processes = active_count;
+    }
+    
+    trace_event(system, EVENT_SWAP_OUT, process_id, active_count);
+    if (system->verbosity & VERBOSE_EVENTS) {
+        fprintf(system->out, "+++ Swapping out process %3d [%3d active processes]\n", 
+               process_id, active_count);
+    }
+}
+
+// Free one data frame chosen by the replacement policy, from the frames of
+// process_id under local replacement. Returns 0 if there is no candidate.
+int evict_page(SystemState *system, int process_id) {
+    FrameList *list = frame_list(system, process_id);
+    if (list->head == NO_FRAME) return 0;
+    
+    int frame = list->head;
+    if (system->policy == REPLACE_CLOCK) {
+        // Referenced frames get a second chance at the back of the list
+        while (system->frame_referenced[frame]) {
+            system->frame_referenced[frame] = 0;
+            unlink_frame(system, list, frame);
+            link_frame(system, list, frame);
+            frame = list->head;
+        }
+    }
+    
+    Process *victim = &system->processes[system->frame_owner[frame]];
+    int page_num = system->frame_page[frame];
+    unlink_frame(system, list, frame);
+    victim->resident_map[page_num / 64] &= ~((uint64_t)1 << (page_num % 64));
+    if (!victim->resident_map[page_num / 64]) {
+        victim->resident_words &= ~((uint32_t)1 << (page_num / 64));
+    }
+    clear_page_frame(system, victim, page_num);
+    tlb_invalidate(system, system->frame_owner[frame], page_num);
+    victim->frames_allocated -= system->data_units;
+    if (system->hot_set_size) {
+        victim->prefetched_map[page_num / 64] &= ~((uint64_t)1 << (page_num % 64));
+    }
+    if (system->prefetch_depth && (victim->readahead_map[page_num / 64] & ((uint64_t)1 << (page_num % 64)))) {
+        victim->readahead_map[page_num / 64] &= ~((uint64_t)1 << (page_num % 64));
+        system->prefetch_wasted++;
+    }
+    
+    put_page_frames(system, page_num, frame);
+    system->num_evictions++;
+    return 1;
+}
+
+int handle_page_fault(SystemState *system, int process_id, int page_num) {
+    Process *p = &system->processes[process_id];
+    
+    // Another process of the dataset has the page: map its frame, no I/O
+    int frame = shared_frame(system, process_id, page_num);
+    if (frame >= 0) {
+        map_page(system, p, page_num);
+        system->shared_faults++;
+        system->fault_ready = system->frame_ready ? system->frame_ready[frame] : 0;
+        return 1;
+    }
+    
+    // Free frames scattered between essential pages hold no data page
+    if (!data_frame_free(system) && system->num_free_frames >= system->data_units) system->unit_shortfalls++;
+    
+    // Evicting a data page always frees a unit
+    if (!data_frame_free(system) && system->policy != REPLACE_NONE) {
+        evict_page(system, process_id);
+    }
+    
+    // Evicted pages are clean (the arrays are only read), so only the
+    // faulting page is transferred
+    if (data_frame_free(system)) {
+        map_page(system, p, page_num);
+        system->fault_ready = storage_request(system, system->data_units, 1);
+        return 1;
+    }
+    
+    // No free frame and nothing to evict: fall back to swapping out, either
+    // the faulting process or others until their frames make room
+    do {
+        int victim = choose_swap_victim(system, process_id);
+        PROFILE_BEGIN(PHASE_SWAP);
+        swap_out_process(system, victim);
+        PROFILE_END();
+        if (victim == process_id) return 0;
+        
+        queue_remove(&system->ready_queue, victim);
+        queue_remove(&system->resume_queue, victim);
+        system->victim_swaps++;
+    } while (!data_frame_free(system));
+    map_page(system, p, page_num);
+    system->fault_ready = storage_request(system, system->data_units, 1);
+    return 1;
+}
+
+
+void swap_in_process(SystemState *system, int process_id) {
+    Process *p = &system->processes[process_id];
+    
+    // Don't swap in if already active
+    if (system->is_active[process_id]) return;
+    
+    int free_frames = system->num_free_frames;
+    map_essential_pages(system, p);
+    
+    // The hot set recorded at swap-out comes back in the same batch
+    uint64_t restore = p->restore_mask;
+    p->restore_mask = 0;
+    while (restore && data_frame_free(system)) {
+        int page_num = p->hot_pages[__builtin_ctzll(restore)];
+        restore &= restore - 1;
+        map_page(system, p, page_num);
+        p->prefetched_map[page_num / 64] |= (uint64_t)1 << (page_num % 64);
+        system->hot_pages_restored++;
+    }
+    // Pages shared with resident processes need no transfer
+    storage_wait(system, storage_request(system, free_frames - system->num_free_frames, 1), 0);
+    
+    account_multiprogramming(system);
+    system->is_active[process_id] = 1;
+    system->num_active++;
+    system->num_swaps++;
+    
+    trace_event(system, EVENT_SWAP_IN, process_id, system->min_active_processes);
+    if (system->verbosity & VERBOSE_EVENTS) {
+        fprintf(system->out, "+++ Swapping in process %3d [%3d active processes]\n", 
+               process_id, system->min_active_processes);
+    }
+}
+
+// Precompute the probe pages of searches first .. first + PATH_BATCH - 1 for the batch kernel
+static void compute_search_paths(SystemState *system, int process_id, int first) {
+    SearchPaths *paths = system->processes[process_id].paths;
+    const int *keys = system->processes[process_id].search_indices;
+    int lanes = system->num_searches - first < PATH_BATCH ? system->num_searches - first : PATH_BATCH;
+    
+    // Lanes past the last search start with an empty interval
+    lane_vector L = { 0 }, R, K = { 0 };
+    for (int lane = 0; lane < PATH_BATCH; lane++) {
+        R[lane] = lane < lanes ? system->array_size[process_id] - 1 : 0;
+        if (lane < lanes) K[lane] = keys[first + lane];
+    }
+    lane_vector length = { 0 };
+    
+    // No search of an array of size elements takes more than ceil(log2(size))
+    // probes; lanes that are done keep an empty interval
+    int probes = 0;
+    while (probes < MAX_PROBES && (1L << probes) < system->array_size[process_id]) probes++;
+    
+    // The same midpoint and mask update as the scalar loop, on every lane
+    for (int probe = 0; probe < probes; probe++) {
+        lane_vector live = L < R;
+        lane_vector M = L + ((R - L) >> 1);
+        paths->pages[probe] = __builtin_convertvector((M >> system->page_shift) + system->essential_pages,
+                                                      page_vector);
+        length -= live;
+        
+        lane_vector right = K > M;  // All ones if k > M, i.e. L = M + 1
+        L = (L & ~right) | ((M + 1) & right);
+        R = (R & right) | (M & ~right);
+    }
+    for (int lane = 0; lane < PATH_BATCH; lane++) paths->length[lane] = length[lane];
+    paths->first = first;
+}
+
+// Read ahead pages of the rest of the search path (count of them, nearest
+// first) into free frames, up to prefetch_depth of them. Nothing is evicted
+// for them; under a storage model their reads are queued behind the fault.
+static void prefetch_pages(SystemState *system, int process_id, const unsigned short *pages, int count) {
+    Process *p = &system->processes[process_id];
+    int issued = 0;
+    for (int i = 0; i < count && issued < system->prefetch_depth && data_frame_free(system); i++) {
+        int page_num = pages[i];
+        if (page_valid(p, page_num) || shared_frame(system, process_id, page_num) >= 0) {
+            continue;
+        }
+        
+        map_page(system, p, page_num);
+        p->readahead_map[page_num / 64] |= (uint64_t)1 << (page_num % 64);
+        long done = storage_request(system, system->data_units, 1);
+        if (system->frame_ready) system->frame_ready[page_frame(p, page_num)] = done;
+        issued++;
+    }
+    system->prefetch_issued += issued;
+}
+
+// Data pages probed by a search for key that has narrowed down to [L, R],
+// with pages of page_size bytes (1 << page_shift words, or -1 if page_size
+// is not a power of two) above essential_pages
+static inline int probe_pages(int page_shift, int page_size, int essential_pages, int L, int R, int key,
+                              unsigned short *pages) {
+    int count = 0;
+    while (L < R) {
+        int M = L + (R - L) / 2;
+        pages[count++] = (page_shift >= 0 ? M >> page_shift : (int)(((long)M * 4) / page_size)) + essential_pages;
+        if (key > M) {
+            L = M + 1;
+        } else {
+            R = M;
+        }
+    }
+    return count;
+}
+
+// Data pages probed by a search of the simulation for key that has narrowed
+// down to [L, R]
+static int search_path(const SystemState *system, int L, int R, int key, unsigned short *pages) {
+    return probe_pages(system->page_shift, system->page_size, system->essential_pages, L, R, key, pages);
+}
+
+// Count a page fault of process_id after flushing the accesses that led to
+// it, and serve it, reading ahead the count pages of next. Returns 0 if the
+// process was swapped out instead.
+static inline int take_fault(SystemState *system, int process_id, ProcessStats *stats, int page_num,
+                             long accesses, const unsigned short *next, int count) {
+    system->page_accesses += accesses;
+    stats->page_accesses += accesses;
+    if (system->page_accesses >= system->next_sample) take_sample(system);
+    system->page_faults++;
+    stats->page_faults++;
+    if (system->scheduler == SWAP_PFF) note_fault_frequency(system, process_id);
+    trace_event(system, EVENT_FAULT, process_id, page_num);
+    if (system->verbosity & VERBOSE_FAULTS) {
+        fprintf(system->out, "\tPage fault by Process %d on page %d\n", process_id, page_num);
+    }
+    PROFILE_BEGIN(PHASE_FAULT);
+    int handled = handle_page_fault(system, process_id, page_num);
+    PROFILE_END();
+    if (!handled) return 0;
+    // The access is retried, and misses the TLB
+    if (system->tlb_sets) tlb_access(system, process_id, page_num);
+    if (count) prefetch_pages(system, process_id, next, count);
+    storage_wait(system, system->fault_ready, 0);
+    return 1;
+}
+
+// Release process_id, which has done all its searches
+static void finish_process(SystemState *system, int process_id) {
+    release_pages(system, &system->processes[process_id]);
+    
+    // A finished process keeps is_active set (it still counts towards the
+    // reported active processes), but no longer runs
+    account_multiprogramming(system);
+    system->num_finished++;
+    if (system->stream) system->stream->finished[system->stream->num_finished++] = process_id;
+    
+    // Try to swap in processes from queue
+    admit_swapped_processes(system);
+}
+
+// A streamed process has run out of queued searches: it finishes if the
+// stream has ended it, else waits for the next search to arrive. Returns 0.
+static int stream_idle(SystemState *system, int process_id) {
+    if (system->stream->ended[process_id]) {
+        finish_process(system, process_id);
+    } else {
+        system->stream->waiting[process_id] = 1;
+    }
+    return 0;
+}
+
+// Run the next search of process_id. Returns 1 if the search completed and
+// the process has more to do, 0 if it was swapped out, has finished, or
+// waits for a search from the stream.
+int simulate_binary_search(SystemState *system, int process_id) {
+    Process *p = &system->processes[process_id];
+    int search = system->current_search[process_id];
+    if (!system->is_active[process_id] || search >= system->num_searches) return 0;
+    if (system->stream) {
+        if (search >= system->stream->queued[process_id]) return stream_idle(system, process_id);
+        system->stream->waiting[process_id] = 0;
+    }
+    
+    int search_key = p->search_indices[search & system->key_mask];
+    
+    // A context switch empties a TLB without ASIDs
+    if (system->tlb_sets && process_id != system->tlb_process) {
+        if (!system->tlb.asid && system->tlb_process != -1) tlb_flush(system);
+        system->tlb_process = process_id;
+    }
+    
+    trace_event(system, EVENT_SEARCH_START, process_id, search + 1);
+    if (__builtin_expect(system->verbosity & VERBOSE_SEARCHES, 0)) {
+        fprintf(system->out, "\tSearch %d by Process %d\n", search + 1, process_id);
+    }
+    
+    ProcessStats *stats = &system->process_stats[process_id];
+    long accesses = 0;
+    
+    if (p->paths) {
+        // Batch kernel: the pages a search probes depend only on its key, so
+        // they come precomputed and only their valid bits are tested here, in
+        // probe order. A set bit of missing is a probe that faults.
+        SearchPaths *paths = p->paths;
+        if (search < paths->first || search >= paths->first + PATH_BATCH) {
+            compute_search_paths(system, process_id, search);
+        }
+        int lane = search - paths->first;
+        int length = paths->length[lane];
+        
+        int probe = 0;
+        while (probe < length) {
+            if (system->track_hits) {
+                int page_num = paths->pages[probe][lane];
+                accesses++;
+                if (!page_valid(p, page_num)) {
+                    unsigned short next[MAX_PROBES];
+                    int count = 0;
+                    if (system->prefetch_depth) {
+                        for (int i = probe + 1; i < length; i++) next[count++] = paths->pages[i][lane];
+                    }
+                    if (!take_fault(system, process_id, stats, page_num, accesses, next, count)) return 0;
+                    accesses = 0;
+                } else {
+                    note_hit(system, process_id, p, page_num, accesses);
+                }
+                probe++;
+                continue;
+            }
+            
+            // A fault may evict pages further down the path, so the check
+            // restarts after each one
+            uint32_t missing = 0;
+            for (int i = probe; i < length; i++) {
+                int page_num = paths->pages[i][lane];
+                missing |= (uint32_t)!page_valid(p, page_num) << i;
+            }
+            if (!missing) {
+                accesses += length - probe;
+                break;
+            }
+            int fault = __builtin_ctz(missing);
+            accesses += fault - probe + 1;
+            if (!take_fault(system, process_id, stats, paths->pages[fault][lane], accesses, NULL, 0)) return 0;
+            accesses = 0;
+            probe = fault + 1;
+        }
+    } else {
+        int L = 0;
+        int R = system->array_size[process_id] - 1;
+        
+        // The search key decides each step at random, so the interval update is
+        // done with masks rather than a branch the CPU would mispredict half the
+        // time. Accesses are counted locally and flushed before any fault
+        // handling, which keeps the fault and swap order of the plain loop.
+        int page_shift = system->page_shift;
+        while (L < R) {
+            int M = L + (R - L) / 2;
+            int page_num = (page_shift >= 0 ? M >> page_shift : (int)(((long)M * 4) / system->page_size)) +
+                           system->essential_pages;
+            accesses++;
+            
+            if (__builtin_expect(!page_valid(p, page_num), 0)) {
+                unsigned short next[MAX_PROBES];
+                int count = 0;
+                if (system->prefetch_depth) {
+                    count = search_path(system, search_key > M ? M + 1 : L, search_key > M ? R : M,
+                                        search_key, next);
+                }
+                if (!take_fault(system, process_id, stats, page_num, accesses, next, count)) return 0;
+                accesses = 0;
+            } else if (system->track_hits) {
+                note_hit(system, process_id, p, page_num, accesses);
+            }
+            
+            int right = -(search_key > M);  // All ones if k > M, i.e. L = M + 1
+            L = (L & ~right) | ((M + 1) & right);
+            R = (R & right) | (M & ~right);
+        }
+    }
+    system->page_accesses += accesses;
+    stats->page_accesses += accesses;
+    if (system->page_accesses >= system->next_sample) take_sample(system);
+    
+    system->current_search[process_id] = ++search;
+    system->searches_completed++;
+    trace_event(system, EVENT_SEARCH_END, process_id, search);
+    
+    if (search >= system->num_searches) {
+        finish_process(system, process_id);
+        return 0;
+    }
+    if (system->stream && search >= system->stream->queued[process_id]) return stream_idle(system, process_id);
+    return 1;
+}
+
+// Next process to swap in: the first in the swap queue, or under working-set
+// or fault-frequency scheduling the one with the smallest working set or
+// fault frequency at its swap-out (the first of those in a tie)
+static int next_swap_in(const SystemState *system) {
+    const SwapQueue *q = &system->swap_queue;
+    int best = q->items[q->front];
+    if (system->scheduler == SWAP_FAULTING) return best;
+    
+    for (int i = q->front; ; i = (i + 1) % q->capacity) {
+        const Process *p = &system->processes[q->items[i]];
+        const Process *b = &system->processes[best];
+        if (system->scheduler == SWAP_WORKING_SET ? p->working_set < b->working_set
+                                                   : p->fault_frequency < b->fault_frequency) {
+            best = q->items[i];
+        }
+        if (i == q->rear) break;
+    }
+    return best;
+}
+
+// Swap processes back in, in next_swap_in order (the order they were
+// swapped out under the default scheduling), after a termination freed
+// frames. Their interrupted searches are restarted before the ready queue is
+// served. The first waiting process only needs room for its essential pages;
+// under ADMIT_WORKING_SET each further one is admitted only if the frames
+// still free cover the working set it had when it was swapped out, so it is
+// not bound to be swapped out again right away. Frames projected for the
+// ones admitted earlier in the batch are set aside.
+void admit_swapped_processes(SystemState *system) {
+    int admitted = 0;
+    int budget = system->num_free_frames;
+    while (!queueIsEmpty(&system->swap_queue) && system->num_free_frames >= system->essential_pages) {
+        int next_process = next_swap_in(system);
+        int projected = system->processes[next_process].working_set;
+        if (projected < system->essential_pages) projected = system->essential_pages;
+        if (admitted > 0) {
+            if (system->admission == ADMIT_SINGLE) break;
+            if (system->admission == ADMIT_WORKING_SET && budget < projected) break;
+        }
+        
+        queue_remove(&system->swap_queue, next_process);
+        if (!system->is_active[next_process]) {
+            PROFILE_BEGIN(PHASE_SWAP);
+            swap_in_process(system, next_process);
+            PROFILE_END();
+            enqueue(&system->resume_queue, next_process);
+            budget -= projected;
+            admitted++;
+        }
+    }
+}
+
+void print_statistics(SystemState *system) {
+    printf("+++ Page access summary\n");
+    printf("\tTotal number of page accesses  = %7ld\n", system->page_accesses);
+    printf("\tTotal number of page faults    = %7ld\n", system->page_faults);
+    printf("\tTotal number of swaps          = %7d\n", system->num_swaps / 2);
+    printf("\tDegree of multiprogramming     = %7d\n", system->min_active_processes);
+    if (system->policy != REPLACE_NONE) {
+        printf("\tTotal number of evictions      = %7ld (%s, %s)\n", system->num_evictions,
+               policy_name(system->policy), system->local_replacement ? "local" : "global");
+    }
+    if (system->data_units > 1) {
+        printf("\tData page size                 = %7d bytes (%d frames, %.1f%% of them past the arrays)\n",
+               system->page_size, system->data_units,
+               system->data_bytes ? 100.0 * system->data_slack / system->data_bytes : 0.0);
+        printf("\tFaults short of a free unit    = %7ld\n", system->unit_shortfalls);
+    }
+    if (system->hot_set_size) {
+        printf("\tHot-set pages restored         = %7ld (%ld faults saved)\n",
+               system->hot_pages_restored, system->hot_faults_saved);
+    }
+    if (system->frame_report) {
+        FramePool *pool = &system->frames;
+        printf("\tContiguous essential batches   = %7ld of %ld (%.1f free extents on average)\n",
+               pool->contiguous_batches, pool->batches,
+               pool->batches ? (double)pool->free_extents / pool->batches : 0.0);
+    }
+    if (system->scheduler != SWAP_FAULTING) {
+        printf("\tSwap-outs of other processes   = %7ld (%s scheduling, window of %ld accesses)\n",
+               system->victim_swaps, scheduler_name(system->scheduler), system->window);
+    }
+    if (system->tlb.entries) {
+        long lookups = system->tlb_hits + system->tlb_misses;
+        double miss_rate = lookups ? (double)system->tlb_misses / lookups : 0.0;
+        printf("\tTLB hits                       = %7ld (%.2f%%, %ld misses, %ld flushes)\n",
+               system->tlb_hits, lookups ? 100.0 * system->tlb_hits / lookups : 0.0, system->tlb_misses,
+               system->tlb_flushes);
+        printf("\tEffective access time          = %7.1f ns (%d-level walk on a miss)\n",
+               system->tlb.memory_time * (1 + miss_rate * system->tlb_walk_levels), system->tlb_walk_levels);
+    }
+    if (system->num_leaves) {
+        // Directories plus the leaves at their peak, against flat tables
+        long two_level = (long)system->num_processes * RESIDENT_WORDS * sizeof(unsigned short *) +
+                         (long)system->peak_leaves * 64 * sizeof(unsigned short);
+        long flat = (long)system->num_processes * PAGE_TABLE_SIZE * sizeof(unsigned short);
+        printf("\tPage table memory              = %7ld KB (%d leaves at most, flat tables: %ld KB)\n",
+               (two_level + 1023) / 1024, system->peak_leaves, (flat + 1023) / 1024);
+    }
+    if (system->num_datasets) {
+        printf("\tFaults on shared frames        = %7ld (%d datasets, at most %d frames saved)\n",
+               system->shared_faults, system->num_datasets, system->peak_shared_mappings);
+    }
+    if (system->prefetch_depth) {
+        printf("\tPages read ahead               = %7ld (%.1f%% used, %ld arrived late, %ld wasted)\n",
+               system->prefetch_issued,
+               system->prefetch_issued ? 100.0 * system->prefetch_used / system->prefetch_issued : 0.0,
+               system->prefetch_late, system->prefetch_wasted);
+    }
+    if (system->storage.queue_depth) {
+        double seconds = system->runtime / 1e9;
+        printf("\tSimulated runtime              = %7.1f ms (%.1f ms waiting for I/O)\n",
+               system->runtime / 1e6, system->io_stall / 1e6);
+        printf("\tPages transferred              = %7ld in, %ld out\n", system->pages_read,
+               system->pages_written);
+        printf("\tDevice utilization             = %6.1f%%\n",
+               system->runtime ? 100.0 * system->device_busy / system->runtime : 0.0);
+        printf("\tSearch throughput              = %7.0f per second\n",
+               seconds > 0 ? system->searches_completed / seconds : 0.0);
+    }
+}
+
+// Simulated time at which the CPU is done and the device has gone idle
+static long storage_runtime(const SystemState *system) {
+    long now = storage_clock(system);
+    return now > system->busy_until ? now : system->busy_until;
+}
+
+// Round-robin dispatch: each time quantum is a single binary search. A
+// process that completes its search goes to the back of the ready queue; one
+// that is swapped out waits in the swap queue until a termination brings it
+// back through the resume queue. Returns -1 if the run stopped because no
+// search could complete.
+int run_simulation(SystemState *system) {
+    run_quanta(system, LONG_MAX);
+    return system->stuck ? -1 : 0;
+}
+
+// Run at most quanta scheduling steps. Returns 1 if there is work left.
+int run_quanta(SystemState *system, long quanta) {
+    for (long step = 0; step < quanta; step++) {
+        int process_id = dequeue(&system->resume_queue);
+        if (process_id == -1) process_id = dequeue(&system->ready_queue);
+        
+        if (process_id == -1) {
+            if (queueIsEmpty(&system->swap_queue)) break;
+            
+            // Every other process has finished: restart the first waiting
+            // one. Once each of them has failed a search with all frames to
+            // itself, none ever will complete.
+            if (++system->restarts > system->num_hosted) {
+                fprintf(stderr, "No search can complete in %d frames\n", system->user_frames);
+                system->stuck = 1;
+                while (!queueIsEmpty(&system->swap_queue)) dequeue(&system->swap_queue);
+                break;
+            }
+            admit_swapped_processes(system);
+            continue;
+        }
+        
+        int finished = system->num_finished;
+        PROFILE_BEGIN(PHASE_SEARCH);
+        int more = simulate_binary_search(system, process_id);
+        PROFILE_END();
+        if (more) {
+            enqueue(&system->ready_queue, process_id);
+            system->restarts = 0;
+        } else if (system->num_finished != finished) {
+            system->restarts = 0;
+        }
+    }
+    
+    if (!queueIsEmpty(&system->resume_queue) || !queueIsEmpty(&system->ready_queue) ||
+        !queueIsEmpty(&system->swap_queue)) {
+        return 1;
+    }
+    
+    // The time series ends with the final state
+    if (system->sample_interval > 0) take_sample(system);
+    system->runtime = storage_runtime(system);
+    return 0;
+}
+
+// Move swapped-out process_id from node from to node to, where it is
+// swapped straight back in and resumes its interrupted search first
+static void migrate_process(SystemState *from, SystemState *to, int process_id) {
+    to->current_search[process_id] = from->current_search[process_id];
+    to->processes[process_id].working_set = from->processes[process_id].working_set;
+    to->processes[process_id].restore_mask = from->processes[process_id].restore_mask;
+    from->num_hosted--;
+    from->migrated_out++;
+    to->num_hosted++;
+    to->migrated_in++;
+    
+    PROFILE_BEGIN(PHASE_SWAP);
+    swap_in_process(to, process_id);
+    PROFILE_END();
+    enqueue(&to->resume_queue, process_id);
+}
+
+// Between epochs: a node that had to swap processes out hands them, in
+// swap-out order, to the node with the most free frames among those not
+// short of memory themselves, as long as their projected working set fits
+// there. Nodes are visited in order, so the outcome is deterministic.
+static int migrate_processes(SystemState *nodes, int num_nodes) {
+    int moved = 0;
+    for (int a = 0; a < num_nodes; a++) {
+        SystemState *from = &nodes[a];
+        while (!queueIsEmpty(&from->swap_queue)) {
+            int process_id = from->swap_queue.items[from->swap_queue.front];
+            int need = from->processes[process_id].working_set;
+            if (need < from->essential_pages) need = from->essential_pages;
+            
+            int target = -1;
+            for (int b = 0; b < num_nodes; b++) {
+                if (b == a || !queueIsEmpty(&nodes[b].swap_queue) || nodes[b].num_free_frames < need) continue;
+                if (target == -1 || nodes[b].num_free_frames > nodes[target].num_free_frames) target = b;
+            }
+            if (target == -1) break;
+            
+            dequeue(&from->swap_queue);
+            migrate_process(from, &nodes[target], process_id);
+            moved++;
+        }
+    }
+    return moved;
+}
+
+// Nodes of a partitioned run, shared by the threads of one epoch
+typedef struct {
+    SystemState *nodes;
+    unsigned char *unfinished;  // Per node, after the last epoch
+    int num_nodes;
+    int num_threads;
+    long epoch;
+} NodePool;
+
+typedef struct {
+    NodePool *pool;
+    int index;
+} NodeWorker;
+
+// Each thread runs one epoch of a fixed subset of the nodes
+static void *node_worker(void *arg) {
+    NodeWorker *worker = arg;
+    NodePool *pool = worker->pool;
+    for (int node = worker->index; node < pool->num_nodes; node += pool->num_threads) {
+        pool->unfinished[node] = run_quanta(&pool->nodes[node], pool->epoch);
+    }
+    return NULL;
+}
+
+// Simulate num_nodes memory nodes, each with its share of the processes
+// (in contiguous blocks) and of the user frames, and its own swap queue.
+// Nodes run on separate threads for epoch scheduling steps at a time, then
+// meet for migration. Nodes never interact within an epoch, so the results
+// do not depend on the number of threads or on their timing.
+int run_partitions(const SimConfig *config, const Trace *trace, int num_nodes, long epoch,
+                   int migrate, int num_threads) {
+    if (num_nodes < 1 || num_nodes > trace->num_processes || epoch <= 0 ||
+        config->user_frames / num_nodes < config->essential_pages) {
+        fprintf(stderr, "Cannot split %d processes and %d frames into %d nodes\n",
+                trace->num_processes, config->user_frames, num_nodes);
+        return -1;
+    }
+    
+    SystemState *nodes = calloc(num_nodes, sizeof(SystemState));
+    unsigned char *unfinished = calloc(num_nodes, 1);
+    pthread_t *threads = calloc(num_nodes, sizeof(pthread_t));
+    NodeWorker *workers = calloc(num_nodes, sizeof(NodeWorker));
+    if (!nodes || !unfinished || !threads || !workers) {
+        fprintf(stderr, "Out of memory for %d nodes\n", num_nodes);
+        free(nodes);
+        free(unfinished);
+        free(threads);
+        free(workers);
+        return -1;
+    }
+    
+    int status = 0;
+    int initialized = 0;
+    for (int i = 0; i < num_nodes && status == 0; i++) {
+        SimConfig node_config = *config;
+        node_config.verbosity = 0;
+        node_config.sample_interval = 0;
+        node_config.user_frames = config->user_frames / num_nodes + (i < config->user_frames % num_nodes);
+        int first = (int)((long)i * trace->num_processes / num_nodes);
+        int last = (int)((long)(i + 1) * trace->num_processes / num_nodes);
+        if (initialize_node(&nodes[i], &node_config, trace, first, last - first) != 0) {
+            status = -1;
+        } else {
+            initialized++;
+        }
+    }
+    
+    if (num_threads <= 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        num_threads = cores > 0 ? (int)cores : 1;
+    }
+    if (num_threads > num_nodes) num_threads = num_nodes;
+    NodePool pool = { nodes, unfinished, num_nodes, num_threads, epoch };
+    
+    int migrations = 0;
+    int more = status == 0;
+    while (more) {
+        // This thread takes the first share; a thread that cannot be
+        // started has its share run here as well
+        int started[num_threads];
+        for (int t = 1; t < num_threads; t++) {
+            workers[t].pool = &pool;
+            workers[t].index = t;
+            started[t] = pthread_create(&threads[t], NULL, node_worker, &workers[t]) == 0;
+        }
+        workers[0].pool = &pool;
+        workers[0].index = 0;
+        node_worker(&workers[0]);
+        for (int t = 1; t < num_threads; t++) {
+            if (started[t]) {
+                pthread_join(threads[t], NULL);
+            } else {
+                node_worker(&workers[t]);
+            }
+        }
+        
+        more = 0;
+        for (int i = 0; i < num_nodes; i++) more |= unfinished[i];
+        if (migrate) {
+            int moved = migrate_processes(nodes, num_nodes);
+            migrations += moved;
+            more |= moved > 0;
+        }
+    }
+    
+    for (int i = 0; i < initialized; i++) {
+        if (nodes[i].stuck) status = -1;
+    }
+    if (status == 0) {
+        // Totals over the nodes; the degree of multiprogramming is the sum of
+        // the lowest counts of the nodes, which need not occur together
+        SystemState total;
+        memset(&total, 0, sizeof(total));
+        total.policy = config->policy;
+        total.local_replacement = config->local_replacement;
+        total.hot_set_size = config->hot_set_size;
+        total.frame_report = config->frame_report;
+        total.storage = config->storage;
+        total.prefetch_depth = config->prefetch_depth;
+        total.tlb = config->tlb;
+        total.scheduler = config->scheduler;
+        total.window = config->window;
+        total.tlb_walk_levels = config->page_table_levels;
+        total.page_size = nodes[0].page_size;
+        total.data_units = nodes[0].data_units;
+        for (int i = 0; i < num_nodes; i++) {
+            SystemState *node = &nodes[i];
+            printf("+++ Node %d: %d processes, %d frames, %ld page accesses, %ld page faults, "
+                   "%d swaps, degree %d, %d migrated in, %d out\n",
+                   i, node->num_hosted, node->user_frames, node->page_accesses, node->page_faults,
+                   node->num_swaps / 2, node->min_active_processes, node->migrated_in, node->migrated_out);
+            total.page_accesses += node->page_accesses;
+            total.page_faults += node->page_faults;
+            total.num_swaps += node->num_swaps;
+            total.min_active_processes += node->min_active_processes;
+            total.num_evictions += node->num_evictions;
+            total.hot_pages_restored += node->hot_pages_restored;
+            total.hot_faults_saved += node->hot_faults_saved;
+            total.frames.batches += node->frames.batches;
+            total.frames.contiguous_batches += node->frames.contiguous_batches;
+            total.frames.free_extents += node->frames.free_extents;
+            // Nodes have a device each and run side by side
+            if (node->runtime > total.runtime) total.runtime = node->runtime;
+            total.io_stall += node->io_stall;
+            total.device_busy += node->device_busy;
+            total.pages_read += node->pages_read;
+            total.pages_written += node->pages_written;
+            total.searches_completed += node->searches_completed;
+            total.prefetch_issued += node->prefetch_issued;
+            total.prefetch_used += node->prefetch_used;
+            total.prefetch_late += node->prefetch_late;
+            total.prefetch_wasted += node->prefetch_wasted;
+            total.tlb_hits += node->tlb_hits;
+            total.tlb_misses += node->tlb_misses;
+            total.tlb_flushes += node->tlb_flushes;
+            total.victim_swaps += node->victim_swaps;
+            total.unit_shortfalls += node->unit_shortfalls;
+            total.data_bytes += node->data_bytes;
+            total.data_slack += node->data_slack;
+        }
+        // Both are averaged over the nodes, like their runtime
+        total.io_stall /= num_nodes;
+        total.device_busy /= num_nodes;
+        print_statistics(&total);
+        printf("\tProcess migrations             = %7d\n", migrations);
+    }
+    
+    for (int i = 0; i < initialized; i++) {
+        free_system(&nodes[i]);
+    }
+    free(nodes);
+    free(unfinished);
+    free(threads);
+    free(workers);
+    return status;
+}
+
+// Open a stream source: "-" for stdin, "tcp:port" to accept one local
+// connection, else a file or named pipe
+static FILE *open_stream(const char *source) {
+    if (strcmp(source, "-") == 0) return stdin;
+    if (strncmp(source, "tcp:", 4) != 0) {
+        FILE *fp = fopen(source, "r");
+        if (!fp) fprintf(stderr, "Error opening stream %s\n", source);
+        return fp;
+    }
+    
+    int port = atoi(source + 4);
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int reuse = 1;
+    if (listener < 0 || port <= 0 || port > 65535 ||
+        setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) != 0 ||
+        bind(listener, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(listener, 1) != 0) {
+        fprintf(stderr, "Error listening on %s\n", source);
+        if (listener >= 0) close(listener);
+        return NULL;
+    }
+    int connection = accept(listener, NULL, NULL);
+    close(listener);
+    FILE *fp = connection >= 0 ? fdopen(connection, "r") : NULL;
+    if (!fp) {
+        fprintf(stderr, "Error accepting a connection on %s\n", source);
+        if (connection >= 0) close(connection);
+    }
+    return fp;
+}
+
+// Position of id in the slot table: its entry, or the empty one it would take
+static int stream_probe(const StreamState *stream, int id) {
+    int i = (int)((uint32_t)id * 2654435761u) & stream->table_mask;
+    while (stream->table[i] && stream->id[stream->table[i] - 1] != id) i = (i + 1) & stream->table_mask;
+    return i;
+}
+
+static int stream_slot(const StreamState *stream, int id) {
+    return stream->table[stream_probe(stream, id)] - 1;
+}
+
+// Drop id from the table, moving up the entries of its probe run
+static void stream_forget(StreamState *stream, int id) {
+    int hole = stream_probe(stream, id);
+    stream->table[hole] = 0;
+    for (int i = (hole + 1) & stream->table_mask; stream->table[i]; i = (i + 1) & stream->table_mask) {
+        int home = (int)((uint32_t)stream->id[stream->table[i] - 1] * 2654435761u) & stream->table_mask;
+        // Entry i may move to the hole unless its home lies in (hole, i]
+        if (((i - home) & stream->table_mask) >= ((i - hole) & stream->table_mask)) {
+            stream->table[hole] = stream->table[i];
+            stream->table[i] = 0;
+            hole = i;
+        }
+    }
+}
+
+// Hand the slots of finished processes back to the stream
+static void recycle_slots(SystemState *system, StreamState *stream) {
+    while (stream->num_finished) {
+        int slot = stream->finished[--stream->num_finished];
+        account_multiprogramming(system);
+        system->is_active[slot] = 0;
+        system->num_active--;
+        system->num_finished--;
+        system->num_hosted--;
+        stream_forget(stream, stream->id[slot]);
+        stream->in_use[slot] = 0;
+        stream->free_slots[stream->num_free++] = slot;
+    }
+}
+
+// A process arrives in a free slot. It starts at once if memory allows,
+// else waits in the swap queue like a swapped-out process. Returns 0 if
+// no slot is free, -1 on a bad request.
+static int stream_arrive(SystemState *system, StreamState *stream, int id, long size) {
+    if (!stream->num_free) return 0;
+    if (stream_slot(stream, id) >= 0) {
+        fprintf(stderr, "Line %ld: process %d has already arrived\n", stream->line, id);
+        return -1;
+    }
+    if (size <= 0 || ((size - 1) * 4) / system->page_size + system->essential_pages >= PAGE_TABLE_SIZE) {
+        fprintf(stderr, "Line %ld: array of process %d does not fit in %d pages\n", stream->line, id,
+                PAGE_TABLE_SIZE);
+        return -1;
+    }
+    
+    int slot = stream->free_slots[--stream->num_free];
+    stream->table[stream_probe(stream, id)] = slot + 1;
+    stream->id[slot] = id;
+    stream->in_use[slot] = 1;
+    stream->queued[slot] = 0;
+    stream->ended[slot] = 0;
+    stream->waiting[slot] = 0;
+    stream->arrivals++;
+    
+    Process *p = &system->processes[slot];
+    p->restore_mask = 0;
+    p->working_set = 0;
+    p->window_start = 0;
+    p->window_faults = p->recent_faults = p->fault_frequency = 0;
+    system->array_size[slot] = (int)size;
+    system->current_search[slot] = 0;
+    memset(&system->process_stats[slot], 0, sizeof(ProcessStats));
+    if (system->hot_set_size) compute_hot_set(system, slot);
+    long data_pages = ((size - 1) * 4) / system->page_size + 1;
+    system->data_bytes += data_pages * system->page_size;
+    system->data_slack += data_pages * system->page_size - size * 4;
+    system->num_hosted++;
+    
+    if (queueIsEmpty(&system->swap_queue) && system->num_free_frames >= system->essential_pages) {
+        map_essential_pages(system, p);
+        account_multiprogramming(system);
+        system->is_active[slot] = 1;
+        system->num_active++;
+        stream->waiting[slot] = 1;
+    } else {
+        enqueue(&system->swap_queue, slot);
+    }
+    if (system->verbosity & VERBOSE_EVENTS) {
+        fprintf(system->out, "+++ Process %3d arrives in slot %3d\n", id, slot);
+    }
+    return 1;
+}
+
+// Queue a search. Returns 0 if the process has a full ring, -1 on a bad
+// request.
+static int stream_search(SystemState *system, StreamState *stream, int id, long key) {
+    int slot = stream_slot(stream, id);
+    if (slot < 0 || stream->ended[slot]) {
+        fprintf(stderr, "Line %ld: process %d is not running\n", stream->line, id);
+        return -1;
+    }
+    if (key < 0 || key >= system->array_size[slot]) {
+        fprintf(stderr, "Line %ld: key %ld is outside the array of process %d\n", stream->line, key, id);
+        return -1;
+    }
+    if (stream->queued[slot] - system->current_search[slot] >= STREAM_KEYS) return 0;
+    
+    stream->keys[(size_t)slot * (STREAM_KEYS + 1) + 1 + (stream->queued[slot] & (STREAM_KEYS - 1))] = (int)key;
+    stream->queued[slot]++;
+    stream->searches++;
+    if (stream->waiting[slot] && system->is_active[slot]) {
+        stream->waiting[slot] = 0;
+        enqueue(&system->ready_queue, slot);
+    }
+    return 1;
+}
+
+// No more searches for the process in slot: it finishes once its queue is done
+static int stream_end(SystemState *system, StreamState *stream, int slot) {
+    stream->ended[slot] = 1;
+    if (stream->waiting[slot] && system->is_active[slot]) {
+        stream->waiting[slot] = 0;
+        finish_process(system, slot);
+    }
+    return 1;
+}
+
+// Processes waiting for searches keep their frames. When nothing else can
+// run and they hold the memory the next swapped-out process needs (its
+// frames at swap-out, and a free data page), swap the largest out.
+static void make_room(SystemState *system, StreamState *stream) {
+    while (queueIsEmpty(&system->ready_queue) && queueIsEmpty(&system->resume_queue) &&
+           !queueIsEmpty(&system->swap_queue)) {
+        int need = system->processes[next_swap_in(system)].working_set;
+        if (need < system->essential_pages) need = system->essential_pages;
+        if (system->num_free_frames >= need && data_frame_free(system)) return;
+        
+        int victim = -1;
+        for (int i = 0; i < stream->num_slots; i++) {
+            if (stream->waiting[i] && system->is_active[i] &&
+                (victim == -1 || system->processes[i].frames_allocated > system->processes[victim].frames_allocated)) {
+                victim = i;
+            }
+        }
+        if (victim == -1) return;
+        swap_out_process(system, victim);
+        system->restarts = 0;
+    }
+}
+
+// Processes in the slots are active (running, waiting or just finished) or
+// swapped out
+static void print_stream_report(FILE *fp, const SystemState *system) {
+    fprintf(fp, "+++ Stream at %ld page accesses: %ld faults, %d swaps, %ld searches, %d processes "
+           "(%d active, %d swapped), %d free frames\n",
+           system->page_accesses, system->page_faults, system->num_swaps / 2, system->searches_completed,
+           system->num_hosted, system->num_active - system->num_finished, system->num_hosted - system->num_active,
+           system->num_free_frames);
+}
+
+// Simulate processes and searches as they arrive on a stream of lines
+//     arrive <id> <array size>
+//     search <id> <key>
+//     exit <id>
+// with # starting a comment. Each command read is followed by one
+// scheduling step. A command that finds no free slot, or a full search
+// queue, waits while the simulation runs on, and nothing more is read
+// meanwhile, so a fast writer is held back. The end of the stream ends
+// every process. A report line goes to stderr every report_interval
+// commands, and a last one to stdout with the statistics.
+int run_stream(const SimConfig *config, const char *source, int num_slots, long report_interval) {
+    if (num_slots <= 0 || num_slots > MAX_REF_PROCESSES) {
+        fprintf(stderr, "Invalid number of stream slots %d\n", num_slots);
+        return -1;
+    }
+    if (report_interval <= 0) {
+        fprintf(stderr, "Invalid stream report interval %ld\n", report_interval);
+        return -1;
+    }
+    if (config->batch_search || config->datasets) {
+        fprintf(stderr, "Streams cannot use the batch kernel or shared data pages\n");
+        return -1;
+    }
+    
+    // The slots start as processes of one-element arrays that never arrived
+    Trace trace;
+    memset(&trace, 0, sizeof(trace));
+    trace.num_processes = num_slots;
+    trace.num_searches = STREAM_KEYS;
+    trace.owned = calloc((size_t)num_slots * (STREAM_KEYS + 1), sizeof(int));
+    StreamState stream;
+    memset(&stream, 0, sizeof(stream));
+    stream.num_slots = num_slots;
+    int table_size = 2;
+    while (table_size < 2 * num_slots) table_size *= 2;
+    stream.table_mask = table_size - 1;
+    stream.queued = calloc(num_slots, sizeof(int));
+    stream.in_use = calloc(num_slots, 1);
+    stream.ended = calloc(num_slots, 1);
+    stream.waiting = calloc(num_slots, 1);
+    stream.id = calloc(num_slots, sizeof(int));
+    stream.free_slots = calloc(num_slots, sizeof(int));
+    stream.finished = calloc(num_slots, sizeof(int));
+    stream.table = calloc(table_size, sizeof(int));
+    int status = -1;
+    SystemState system;
+    system.out = stdout;
+    system.events = NULL;
+    int ready = 0;
+    if (!trace.owned || !stream.queued || !stream.in_use || !stream.ended || !stream.waiting || !stream.id || !stream.free_slots ||
+        !stream.finished || !stream.table) {
+        fprintf(stderr, "Out of memory for %d stream slots\n", num_slots);
+        goto out;
+    }
+    for (int i = 0; i < num_slots; i++) {
+        trace.owned[(size_t)i * (STREAM_KEYS + 1)] = 1;
+        stream.free_slots[i] = num_slots - 1 - i;
+    }
+    stream.num_free = num_slots;
+    trace.records = trace.owned;
+    
+    SimConfig stream_config = *config;
+    stream_config.sample_interval = 0;
+    if (initialize_node(&system, &stream_config, &trace, 0, 0) != 0) goto out;
+    ready = 1;
+    stream.in = open_stream(source);
+    if (!stream.in) goto out;
+    
+    // Searches come from the key rings, which search_indices already points
+    // into, and no process runs out of them. The degree of multiprogramming
+    // is lowered by swap-outs as in a run.
+    stream.keys = trace.owned;
+    system.stream = &stream;
+    system.num_searches = INT_MAX;
+    system.key_mask = STREAM_KEYS - 1;
+    system.min_active_processes = num_slots;
+    
+    long commands = 0;
+    char line[STREAM_LINE], command[16];
+    long first_arg = 0, second_arg = 0;
+    int have_command = 0;
+    status = 0;
+    for (;;) {
+        if (!have_command) {
+            if (!fgets(line, sizeof(line), stream.in)) break;
+            stream.line++;
+            line[strcspn(line, "#\n")] = '\0';
+            int fields = sscanf(line, "%15s %ld %ld", command, &first_arg, &second_arg);
+            if (fields <= 0) continue;
+            int arity = strcmp(command, "exit") == 0 ? 2 :
+                        strcmp(command, "arrive") == 0 || strcmp(command, "search") == 0 ? 3 : 0;
+            if (!arity || fields != arity || first_arg < INT_MIN || first_arg > INT_MAX) {
+                fprintf(stderr, "Line %ld: bad command: %s\n", stream.line, line);
+                status = -1;
+                break;
+            }
+            have_command = 1;
+        }
+        
+        int done;
+        if (command[0] == 'a') {
+            done = stream_arrive(&system, &stream, (int)first_arg, second_arg);
+        } else if (command[0] == 's') {
+            done = stream_search(&system, &stream, (int)first_arg, second_arg);
+        } else {
+            int slot = stream_slot(&stream, (int)first_arg);
+            if (slot < 0) {
+                fprintf(stderr, "Line %ld: process %ld is not running\n", stream.line, first_arg);
+                done = -1;
+            } else {
+                done = stream_end(&system, &stream, slot);
+            }
+        }
+        if (done < 0) {
+            status = -1;
+            break;
+        }
+        have_command = !done;
+        if (done) commands++;
+        
+        make_room(&system, &stream);
+        int work = run_quanta(&system, 1);
+        recycle_slots(&system, &stream);
+        if (!done && !work) {
+            fprintf(stderr, "Line %ld: every one of the %d slots holds a waiting process\n", stream.line, num_slots);
+            status = -1;
+            break;
+        }
+        if (done && commands % report_interval == 0) print_stream_report(stderr, &system);
+    }
+    
+    if (status == 0) {
+        // The end of the stream ends every process
+        for (int i = 0; i < num_slots; i++) {
+            if (stream.in_use[i] && !stream.ended[i]) stream_end(&system, &stream, i);
+        }
+        if (run_simulation(&system) != 0) {
+            status = -1;
+        } else {
+            recycle_slots(&system, &stream);
+            print_stream_report(stdout, &system);
+            print_statistics(&system);
+            printf("\tProcesses streamed             = %7ld (%ld searches)\n", stream.arrivals, stream.searches);
+        }
+    }
+    
+out:
+    if (stream.in && stream.in != stdin) fclose(stream.in);
+    if (ready) free_system(&system);
+    free(trace.owned);
+    free(stream.queued);
+    free(stream.in_use);
+    free(stream.ended);
+    free(stream.waiting);
+    free(stream.id);
+    free(stream.free_slots);
+    free(stream.finished);
+    free(stream.table);
+    return status;
+}
+
+// Sweep worker: takes configurations off the shared list until none are left.
+// Every simulation owns its SystemState, so workers share nothing else.
+static void *sweep_worker(void *arg) {
+    SweepPool *pool = arg;
+    SystemState state;
+    SystemState *system = &state;
+    
+    while (1) {
+        pthread_mutex_lock(&pool->lock);
+        int job_id = pool->next_job < pool->num_jobs ? pool->next_job++ : -1;
+        pthread_mutex_unlock(&pool->lock);
+        if (job_id == -1) break;
+        
+        SweepJob *job = &pool->jobs[job_id];
+        system->out = NULL;
+        system->events = NULL;
+        SimConfig config = job->config;
+        if (config.verbosity) {
+            // Kept apart, and printed in sweep order once every run is done
+            system->out = open_memstream(&job->log, &job->log_size);
+            if (!system->out) config.verbosity = 0;
+        }
+        if (!job->trace || initialize_system(system, &config, job->trace) != 0) {
+            if (system->out) fclose(system->out);
+            job->status = -1;
+            continue;
+        }
+        int stuck = run_simulation(system) != 0;
+        if (system->out) fclose(system->out);
+        if (stuck) {
+            job->status = -1;
+            free_system(system);
+            continue;
+        }
+        
+        job->status = 0;
+        job->page_accesses = system->page_accesses;
+        job->page_faults = system->page_faults;
+        job->num_swaps = system->num_swaps / 2;
+        job->num_evictions = system->num_evictions;
+        job->hot_faults_saved = system->hot_faults_saved;
+        job->min_active_processes = system->min_active_processes;
+        job->avg_multiprogramming = average_multiprogramming(system);
+        job->runtime = system->runtime;
+        job->io_stall = system->io_stall;
+        job->device_busy = system->device_busy;
+        job->searches_completed = system->searches_completed;
+        free_system(system);
+    }
+    
+    return NULL;
+}
+
+// Load every distinct input file of a sweep once; configurations sharing a
+// file share its (read-only) trace
+static int load_sweep_traces(SweepPool *pool) {
+    pool->traces = malloc((pool->num_jobs > 0 ? pool->num_jobs : 1) * sizeof(Trace));
+    if (!pool->traces) {
+        fprintf(stderr, "Out of memory for sweep traces\n");
+        return -1;
+    }
+    
+    for (int i = 0; i < pool->num_jobs; i++) {
+        SweepJob *job = &pool->jobs[i];
+        int j;
+        for (j = 0; j < i; j++) {
+            if (strcmp(pool->jobs[j].config.input_file, job->config.input_file) == 0) break;
+        }
+        if (j < i) {
+            job->trace = pool->jobs[j].trace;
+        } else if (load_trace(&pool->traces[pool->num_traces], job->config.input_file) == 0) {
+            job->trace = &pool->traces[pool->num_traces++];
+        }
+    }
+    return 0;
+}
+
+static void free_sweep(SweepPool *pool) {
+    for (int i = 0; i < pool->num_traces; i++) {
+        free_trace(&pool->traces[i]);
+    }
+    for (int i = 0; i < pool->num_jobs; i++) {
+        free(pool->jobs[i].log);
+    }
+    free(pool->traces);
+    free(pool->jobs);
+}
+
+// Read a sweep file and run its configurations on a pool of worker threads.
+// Each non-empty line not starting with '#' holds
+//     input_file [user_frames [essential_pages [page_size [policy [local|global [hot_set [admission
+//                [verbosity [storage]]]]]]]]]
+// with omitted fields taking the default values. Runs are quiet unless their
+// line gives a verbosity (0 keeps a run quiet ahead of a storage model). One
+// CSV row is printed per configuration, in the order of the sweep file; if
+// any line has a storage model, the rows end with its timing figures.
+int run_sweep(const char *sweep_file, int num_threads) {
+    FILE *fp = fopen(sweep_file, "r");
+    if (!fp) {
+        fprintf(stderr, "Error opening sweep file %s\n", sweep_file);
+        return -1;
+    }
+    
+    SweepPool pool = { NULL, 0, 0, PTHREAD_MUTEX_INITIALIZER, NULL, 0 };
+    int capacity = 0;
+    char line[2 * MAX_PATH_LEN];
+    int line_no = 0;
+    while (fgets(line, sizeof(line), fp)) {
+        line_no++;
+        char file[MAX_PATH_LEN], policy[32], scope[32], admission[32], verbosity[64], storage[256];
+        SimConfig config;
+        init_config(&config);
+        config.verbosity = 0;
+        
+        int fields = sscanf(line, "%255s %d %d %d %31s %31s %d %31s %63s %255s", file, &config.user_frames,
+                            &config.essential_pages, &config.page_size, policy, scope,
+                            &config.hot_set_size, admission, verbosity, storage);
+        if (fields < 1 || file[0] == '#') continue;
+        snprintf(config.input_file, MAX_PATH_LEN, "%s", file);
+        if ((fields >= 5 && parse_policy(policy, &config.policy) != 0) ||
+            (fields >= 6 && parse_scope(scope, &config.local_replacement) != 0) ||
+            (fields >= 8 && parse_admission(admission, &config.admission) != 0) ||
+            (fields >= 9 && parse_verbosity(verbosity, &config.verbosity) != 0) ||
+            (fields >= 10 && parse_storage(storage, &config.storage) != 0)) {
+            fprintf(stderr, "Invalid policy setting in sweep file (line %d)\n", line_no);
+            free(pool.jobs);
+            fclose(fp);
+            return -1;
+        }
+        
+        if (pool.num_jobs == capacity) {
+            capacity = capacity ? 2 * capacity : 64;
+            SweepJob *jobs = realloc(pool.jobs, capacity * sizeof(SweepJob));
+            if (!jobs) {
+                fprintf(stderr, "Out of memory reading sweep file (line %d)\n", line_no);
+                free(pool.jobs);
+                fclose(fp);
+                return -1;
+            }
+            pool.jobs = jobs;
+        }
+        memset(&pool.jobs[pool.num_jobs], 0, sizeof(SweepJob));
+        pool.jobs[pool.num_jobs++].config = config;
+    }
+    fclose(fp);
+    
+    if (load_sweep_traces(&pool) != 0) {
+        free(pool.jobs);
+        return -1;
+    }
+    
+    if (num_threads <= 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        num_threads = cores > 0 ? (int)cores : 1;
+    }
+    if (num_threads > pool.num_jobs) num_threads = pool.num_jobs;
+    
+    pthread_t *threads = malloc((num_threads > 0 ? num_threads : 1) * sizeof(pthread_t));
+    if (!threads) {
+        fprintf(stderr, "Out of memory for sweep threads\n");
+        free_sweep(&pool);
+        return -1;
+    }
+    int started = 0;
+    for (int i = 0; i < num_threads; i++) {
+        if (pthread_create(&threads[i], NULL, sweep_worker, &pool) != 0) break;
+        started++;
+    }
+    // With no thread at all, fall back to running the sweep here
+    if (started == 0 && pool.num_jobs > 0) sweep_worker(&pool);
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+    
+    for (int i = 0; i < pool.num_jobs; i++) {
+        if (pool.jobs[i].log) fwrite(pool.jobs[i].log, 1, pool.jobs[i].log_size, stdout);
+    }
+    
+    int timed = 0;
+    for (int i = 0; i < pool.num_jobs; i++) {
+        timed |= pool.jobs[i].config.storage.queue_depth > 0;
+    }
+    
+    int failed = 0;
+    printf("input_file,user_frames,essential_pages,page_size,policy,allocation,hot_set,admission,"
+           "page_accesses,page_faults,swaps,degree_of_multiprogramming,"
+           "avg_multiprogramming,evictions,hot_faults_saved%s\n",
+           timed ? ",runtime_ms,io_stall_ms,device_utilization,searches_per_second" : "");
+    for (int i = 0; i < pool.num_jobs; i++) {
+        SweepJob *job = &pool.jobs[i];
+        printf("%s,%d,%d,%d,%s,%s,%d,%s,", job->config.input_file, job->config.user_frames,
+               job->config.essential_pages, job->config.page_size, policy_name(job->config.policy),
+               job->config.local_replacement ? "local" : "global", job->config.hot_set_size,
+               admission_name(job->config.admission));
+        if (job->status != 0) {
+            printf("error,error,error,error,error,error,error%s\n", timed ? ",error,error,error,error" : "");
+            failed++;
+            continue;
+        }
+        printf("%ld,%ld,%d,%d,%.2f,%ld,%ld", job->page_accesses, job->page_faults,
+               job->num_swaps, job->min_active_processes, job->avg_multiprogramming,
+               job->num_evictions, job->hot_faults_saved);
+        if (timed && !job->config.storage.queue_depth) {
+            printf(",,,,");
+        } else if (timed) {
+            printf(",%.3f,%.3f,%.4f,%.1f", job->runtime / 1e6, job->io_stall / 1e6,
+                   job->runtime ? (double)job->device_busy / job->runtime : 0.0,
+                   job->runtime ? job->searches_completed / (job->runtime / 1e9) : 0.0);
+        }
+        printf("\n");
+    }
+    
+    free_sweep(&pool);
+    return failed ? -1 : 0;
+}
+
+static double elapsed_seconds(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) * 1e-9;
+}
+
+// Time runs quiet simulations of one configuration and return the fastest,
+// in seconds, or -1. Set-up is not timed. With print, the statistics of the
+// last run are printed.
+static double time_runs(const SimConfig *config, const Trace *trace, int runs, int print, long *page_accesses) {
+    SimConfig quiet = *config;
+    quiet.verbosity = 0;
+    SystemState system;
+    double best = 0;
+    for (int run = 0; run < runs; run++) {
+        system.out = NULL;
+        system.events = NULL;
+        if (initialize_system(&system, &quiet, trace) != 0) return -1;
+        
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        int stuck = run_simulation(&system) != 0;
+        double seconds = elapsed_seconds(&start);
+        if (stuck) {
+            free_system(&system);
+            return -1;
+        }
+        if (run == 0 || seconds < best) best = seconds;
+        
+        // Every run is identical, so the last one stands for all of them
+        if (print && run == runs - 1) print_statistics(&system);
+        *page_accesses = system.page_accesses;
+        free_system(&system);
+    }
+    return best > 0 ? best : 1e-9;
+}
+
+// Time runs quiet simulations of one configuration. Rates are those of the
+// fastest run; set-up is not timed.
+int run_benchmark(const SimConfig *config, const Trace *trace, int runs) {
+    long page_accesses = 0;
+    double best = time_runs(config, trace, runs, 1, &page_accesses);
+    if (best < 0) return -1;
+    
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    long searches = (long)trace->num_processes * trace->num_searches;
+    printf("+++ Benchmark (best of %d runs, %d processes x %d searches)\n",
+           runs, trace->num_processes, trace->num_searches);
+    printf("\tSimulation time                = %10.3f ms\n", best * 1e3);
+    printf("\tSearches per second            = %10.0f\n", searches / best);
+    printf("\tPage accesses per second       = %10.0f\n", page_accesses / best);
+    printf("\tPeak resident set size         = %10ld KB\n", usage.ru_maxrss);
+    return 0;
+}
+
+// Collapse each run of white space in line to one space and drop it at both
+// ends and after a bracket, so that column padding does not count
+static void squeeze(char *line) {
+    char *out = line;
+    for (char *in = line; *in; in++) {
+        if (*in == ' ' || *in == '\t' || *in == '\r' || *in == '\n') {
+            if (out > line && out[-1] != ' ' && out[-1] != '[') *out++ = ' ';
+        } else {
+            *out++ = *in;
+        }
+    }
+    if (out > line && out[-1] == ' ') out--;
+    *out = '\0';
+}
+
+// VERBOSE_* category of a squeezed output line that a check compares, or 0
+static unsigned checked_category(const char *line) {
+    if (strncmp(line, "+++ Swapping ", 13) == 0) return VERBOSE_EVENTS;
+    if (strncmp(line, "Search ", 7) == 0) return VERBOSE_SEARCHES;
+    if (strncmp(line, "Page fault ", 11) == 0) return VERBOSE_FAULTS;
+    return 0;
+}
+
+// Next line of a captured output in one of categories, squeezed, or NULL
+static char *next_checked_line(char **cursor, unsigned categories) {
+    while (**cursor) {
+        char *line = *cursor;
+        char *end = strchr(line, '\n');
+        if (end) {
+            *end = '\0';
+            *cursor = end + 1;
+        } else {
+            *cursor = line + strlen(line);
+        }
+        squeeze(line);
+        if (checked_category(line) & categories) return line;
+    }
+    return NULL;
+}
+
+// Run the simulation and compare it with a golden output: the swap messages
+// one by one (and the searches and faults, if the golden output has them),
+// then the totals of the page access summary
+static int check_golden(const SimConfig *config, const Trace *trace, const char *file) {
+    static const char *total_formats[] = { "Total number of page accesses = %ld",
+                                           "Total number of page faults = %ld",
+                                           "Total number of swaps = %ld",
+                                           "Degree of multiprogramming = %ld" };
+    static const char *total_names[] = { "total number of page accesses", "total number of page faults",
+                                         "total number of swaps", "degree of multiprogramming" };
+    FILE *fp = fopen(file, "r");
+    if (!fp) {
+        fprintf(stderr, "Error opening golden output %s\n", file);
+        return -1;
+    }
+    
+    // A first pass finds what the run has to print, and the totals
+    char line[CHECK_LINE];
+    unsigned categories = 0;
+    long expected[4];
+    int found = 0;
+    while (fgets(line, sizeof(line), fp)) {
+        squeeze(line);
+        categories |= checked_category(line);
+        for (int i = 0; i < 4; i++) {
+            if (sscanf(line, total_formats[i], &expected[i]) == 1) found |= 1 << i;
+        }
+    }
+    if (found != 0xf) {
+        fprintf(stderr, "%s has no page access summary\n", file);
+        fclose(fp);
+        return -1;
+    }
+    
+    printf("+++ Checked against %s\n", file);
+    fflush(stdout);
+    SimConfig run = *config;
+    run.verbosity = categories | VERBOSE_EVENTS;
+    SystemState system;
+    char *log = NULL;
+    size_t log_size = 0;
+    system.events = NULL;
+    system.out = open_memstream(&log, &log_size);
+    if (!system.out || initialize_system(&system, &run, trace) != 0) {
+        if (system.out) fclose(system.out);
+        free(log);
+        fclose(fp);
+        return -1;
+    }
+    int stuck = run_simulation(&system) != 0;
+    fclose(system.out);
+    if (stuck) {
+        free_system(&system);
+        free(log);
+        fclose(fp);
+        return -1;
+    }
+    long actual[4] = { system.page_accesses, system.page_faults, system.num_swaps / 2,
+                       system.min_active_processes };
+    free_system(&system);
+    
+    // Past the first difference the two no longer line up
+    int status = 0;
+    int line_num = 0;
+    int compared = 0;
+    int matched = 0;
+    char *cursor = log;
+    rewind(fp);
+    while (fgets(line, sizeof(line), fp)) {
+        line_num++;
+        squeeze(line);
+        if (!checked_category(line)) continue;
+        compared++;
+        if (status != 0) continue;
+        char *printed = next_checked_line(&cursor, categories);
+        if (!printed) {
+            fprintf(stderr, "%s:%d: expected \"%s\", the run printed nothing more\n", file, line_num, line);
+            status = -1;
+        } else if (strcmp(printed, line) != 0) {
+            fprintf(stderr, "%s:%d: expected \"%s\", the run printed \"%s\"\n", file, line_num, line, printed);
+            status = -1;
+        } else {
+            matched++;
+        }
+    }
+    char *extra = status == 0 ? next_checked_line(&cursor, categories) : NULL;
+    if (extra) {
+        fprintf(stderr, "%s: the run printed \"%s\" past the end\n", file, extra);
+        status = -1;
+    }
+    
+    int totals = 0;
+    for (int i = 0; i < 4; i++) {
+        if (actual[i] == expected[i]) {
+            totals++;
+        } else {
+            fprintf(stderr, "%s: %s is %ld, expected %ld\n", file, total_names[i], actual[i], expected[i]);
+            status = -1;
+        }
+    }
+    
+    printf("\tMessages matched               = %7d of %d\n", matched, compared);
+    printf("\tTotals matched                 = %7d of 4\n", totals);
+    free(log);
+    fclose(fp);
+    return status;
+}
+
+// Searches per second stored in a baseline file: 1 if read, 0 if there is
+// no such file, -1 on error
+static int read_baseline(const char *file, double *rate) {
+    if (access(file, F_OK) != 0) return 0;
+    FILE *fp = fopen(file, "r");
+    if (!fp) {
+        fprintf(stderr, "Error opening baseline %s\n", file);
+        return -1;
+    }
+    char line[CHECK_LINE];
+    int status = -1;
+    while (status != 1 && fgets(line, sizeof(line), fp)) {
+        if (line[0] == '#' || line[0] == '\n') continue;
+        status = sscanf(line, "%lf", rate) == 1 && *rate > 0 ? 1 : -1;
+        if (status != 1) break;
+    }
+    fclose(fp);
+    if (status != 1) fprintf(stderr, "No rate of searches in baseline %s\n", file);
+    return status;
+}
+
+// Check a run against each of a comma-separated list of golden outputs,
+// then time it. With a baseline file, a rate below CHECK_FLOOR of the
+// stored one fails the check; a missing baseline is written with the rate
+// measured, as long as the outputs matched.
+int run_check(const SimConfig *config, const Trace *trace, const char *golden_files, const char *baseline_file,
+              int runs) {
+    char *files = malloc(strlen(golden_files) + 1);
+    if (!files) return -1;
+    strcpy(files, golden_files);
+    int status = 0;
+    for (char *file = strtok(files, ","); file; file = strtok(NULL, ",")) {
+        if (check_golden(config, trace, file) != 0) status = -1;
+    }
+    free(files);
+    
+    long page_accesses = 0;
+    double best = time_runs(config, trace, runs, 0, &page_accesses);
+    if (best < 0) return -1;
+    double rate = (double)trace->num_processes * trace->num_searches / best;
+    printf("+++ Throughput (best of %d runs)\n", runs);
+    printf("\tSimulation time                = %10.3f ms\n", best * 1e3);
+    printf("\tSearches per second            = %10.0f", rate);
+    if (!baseline_file) {
+        printf("\n");
+        return status;
+    }
+    
+    double baseline;
+    int stored = read_baseline(baseline_file, &baseline);
+    if (stored < 0) {
+        printf("\n");
+        return -1;
+    }
+    if (stored) {
+        printf(" (%.1f%% of the baseline)\n", 100 * rate / baseline);
+        if (rate < baseline * CHECK_FLOOR) {
+            fprintf(stderr, "Throughput fell below %.0f%% of the baseline in %s\n", 100 * CHECK_FLOOR,
+                    baseline_file);
+            status = -1;
+        }
+        return status;
+    }
+    if (status != 0) {
+        printf(" (not recorded, the output differs)\n");
+        return status;
+    }
+    
+    FILE *fp = fopen(baseline_file, "w");
+    if (!fp) {
+        printf("\n");
+        fprintf(stderr, "Error creating baseline %s\n", baseline_file);
+        return -1;
+    }
+    fprintf(fp, "# Searches per second of %s, best of %d runs\n%.0f\n", config->input_file, runs, rate);
+    if (fclose(fp) != 0) status = -1;
+    printf(" (recorded as the baseline)\n");
+    return status;
+}
+
+// Start recording events of a run into file
+EventRing *open_event_trace(const char *file, unsigned verbosity) {
+    EventRing *ring = calloc(1, sizeof(EventRing));
+    if (!ring) return NULL;
+    ring->fp = fopen(file, "wb");
+    if (!ring->fp) {
+        fprintf(stderr, "Error creating event trace %s\n", file);
+        free(ring);
+        return NULL;
+    }
+    
+    EventHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, EVENT_MAGIC, sizeof(header.magic));
+    header.verbosity = verbosity;
+    if (fwrite(&header, sizeof(header), 1, ring->fp) != 1) ring->failed = 1;
+    return ring;
+}
+
+// Close the trace of a finished run with its summary
+int close_event_trace(SystemState *system) {
+    EventRing *ring = system->events;
+    trace_event(system, EVENT_SUMMARY, -1, 0);
+    flush_events(ring);
+    
+    EventSummary summary;
+    memset(&summary, 0, sizeof(summary));
+    summary.page_accesses = system->page_accesses;
+    summary.page_faults = system->page_faults;
+    summary.num_evictions = system->num_evictions;
+    summary.hot_pages_restored = system->hot_pages_restored;
+    summary.hot_faults_saved = system->hot_faults_saved;
+    summary.batches = system->frames.batches;
+    summary.contiguous_batches = system->frames.contiguous_batches;
+    summary.free_extents = system->frames.free_extents;
+    summary.num_swaps = system->num_swaps;
+    summary.min_active_processes = system->min_active_processes;
+    summary.policy = system->policy;
+    summary.local_replacement = system->local_replacement;
+    summary.hot_set_size = system->hot_set_size;
+    summary.frame_report = system->frame_report;
+    if (fwrite(&summary, sizeof(summary), 1, ring->fp) != 1) ring->failed = 1;
+    
+    int failed = fclose(ring->fp) != 0 || ring->failed;
+    free(ring);
+    system->events = NULL;
+    if (failed) {
+        fprintf(stderr, "Error writing event trace\n");
+        return -1;
+    }
+    return 0;
+}
+
+// Print the text output of a traced run, exactly as the run would have
+int decode_event_trace(const char *file) {
+    FILE *fp = fopen(file, "rb");
+    if (!fp) {
+        fprintf(stderr, "Error opening event trace %s\n", file);
+        return -1;
+    }
+    
+    EventHeader header;
+    if (fread(&header, sizeof(header), 1, fp) != 1 ||
+        memcmp(header.magic, EVENT_MAGIC, sizeof(header.magic)) != 0) {
+        fprintf(stderr, "%s is not an event trace\n", file);
+        fclose(fp);
+        return -1;
+    }
+    
+    TraceEvent events[EVENT_RING_SIZE];
+    size_t count;
+    long position = sizeof(EventHeader);  // Offset of events[0]
+    int done = 0;
+    while (!done && (count = fread(events, sizeof(TraceEvent), EVENT_RING_SIZE, fp)) > 0) {
+        for (size_t i = 0; i < count && !done; i++) {
+            const TraceEvent *event = &events[i];
+            switch (EVENT_TYPE(event)) {
+                case EVENT_INIT:
+                    if (!(header.verbosity & VERBOSE_EVENTS)) break;
+                    printf("+++ Simulation data read from file\n");
+                    printf("+++ Kernel data initialized\n");
+                    break;
+                case EVENT_FAULT:
+                    if (header.verbosity & VERBOSE_FAULTS) {
+                        printf("\tPage fault by Process %d on page %d\n", event->process_id, EVENT_ARG(event));
+                    }
+                    break;
+                case EVENT_SWAP_OUT:
+                    if (!(header.verbosity & VERBOSE_EVENTS)) break;
+                    printf("+++ Swapping out process %3d [%3d active processes]\n",
+                           event->process_id, EVENT_ARG(event));
+                    break;
+                case EVENT_SWAP_IN:
+                    if (!(header.verbosity & VERBOSE_EVENTS)) break;
+                    printf("+++ Swapping in process %3d [%3d active processes]\n",
+                           event->process_id, EVENT_ARG(event));
+                    break;
+                case EVENT_SEARCH_START:
+                    if (header.verbosity & VERBOSE_SEARCHES) {
+                        printf("\tSearch %d by Process %d\n", EVENT_ARG(event), event->process_id);
+                    }
+                    break;
+                case EVENT_SUMMARY:
+                    // The summary follows right after this event
+                    done = fseek(fp, position + (long)(i + 1) * (long)sizeof(TraceEvent), SEEK_SET) == 0;
+                    break;
+            }
+        }
+        position += (long)count * (long)sizeof(TraceEvent);
+    }
+    
+    EventSummary summary;
+    if (!done || fread(&summary, sizeof(summary), 1, fp) != 1) {
+        fprintf(stderr, "Event trace %s is truncated\n", file);
+        fclose(fp);
+        return -1;
+    }
+    fclose(fp);
+    
+    SystemState system;
+    memset(&system, 0, sizeof(system));
+    system.page_accesses = summary.page_accesses;
+    system.page_faults = summary.page_faults;
+    system.num_evictions = summary.num_evictions;
+    system.hot_pages_restored = summary.hot_pages_restored;
+    system.hot_faults_saved = summary.hot_faults_saved;
+    system.frames.batches = summary.batches;
+    system.frames.contiguous_batches = summary.contiguous_batches;
+    system.frames.free_extents = summary.free_extents;
+    system.num_swaps = summary.num_swaps;
+    system.min_active_processes = summary.min_active_processes;
+    system.policy = (ReplacementPolicy)summary.policy;
+    system.local_replacement = summary.local_replacement;
+    system.hot_set_size = summary.hot_set_size;
+    system.frame_report = summary.frame_report;
+    print_statistics(&system);
+    return 0;
+}
+
+// Start writing a reference string into file
+static RefRecorder *open_reference_string(const char *file, const SimConfig *config, int num_processes) {
+    RefRecorder *recorder = calloc(1, sizeof(RefRecorder));
+    if (!recorder) return NULL;
+    recorder->fp = fopen(file, "wb");
+    if (!recorder->fp) {
+        fprintf(stderr, "Error creating reference string %s\n", file);
+        free(recorder);
+        return NULL;
+    }
+    
+    // The header is written again with the totals at the end
+    memcpy(recorder->header.magic, REFS_MAGIC, sizeof(recorder->header.magic));
+    recorder->header.num_processes = num_processes;
+    recorder->header.essential_pages = config->essential_pages;
+    recorder->header.page_size = config->page_size;
+    if (fwrite(&recorder->header, sizeof(RefsHeader), 1, recorder->fp) != 1) recorder->failed = 1;
+    return recorder;
+}
+
+// Append the count pages probed by a search of process_id
+static void record_search(RefRecorder *recorder, int process_id, const unsigned short *pages, int count) {
+    if (recorder->count + count > REFS_BUFFER) {
+        if (fwrite(recorder->refs, sizeof(uint32_t), recorder->count, recorder->fp) != (size_t)recorder->count) {
+            recorder->failed = 1;
+        }
+        recorder->count = 0;
+    }
+    
+    int first = recorder->count;
+    for (int i = 0; i < count; i++) {
+        if (recorder->count > first && pages[i] == pages[i - 1]) {
+            recorder->refs[recorder->count - 1] |= REF_REPEAT;
+        } else {
+            recorder->refs[recorder->count++] = (uint32_t)process_id << REF_PAGE_BITS | pages[i];
+        }
+    }
+    recorder->header.accesses += count;
+    recorder->header.references += recorder->count - first;
+}
+
+static int close_reference_string(RefRecorder *recorder) {
+    if (recorder->count &&
+        fwrite(recorder->refs, sizeof(uint32_t), recorder->count, recorder->fp) != (size_t)recorder->count) {
+        recorder->failed = 1;
+    }
+    if (fseek(recorder->fp, 0, SEEK_SET) != 0 ||
+        fwrite(&recorder->header, sizeof(RefsHeader), 1, recorder->fp) != 1) {
+        recorder->failed = 1;
+    }
+    
+    int failed = fclose(recorder->fp) != 0 || recorder->failed;
+    free(recorder);
+    if (failed) {
+        fprintf(stderr, "Error writing reference string\n");
+        return -1;
+    }
+    return 0;
+}
+
+// Convert a trace into its reference string without running the simulator.
+// The string is the work the processes ask for: every search of every
+// process, taken in turns from process 0 as the ready queue runs them while
+// no process is swapped out. It depends only on the trace and the page
+// geometry (-p, -e), so a replay gives the fault counts of live -r runs at
+// any frame budget.
+int write_reference_string(const Trace *trace, const SimConfig *config, const char *file) {
+    if (trace->num_processes > MAX_REF_PROCESSES) {
+        fprintf(stderr, "A reference string can name at most %d processes\n", MAX_REF_PROCESSES);
+        return -1;
+    }
+    if (config->essential_pages <= 0 || config->essential_pages >= PAGE_TABLE_SIZE ||
+        config->page_size < 4 || config->page_size % 4 != 0) {
+        fprintf(stderr, "Invalid configuration for %s\n", config->input_file);
+        return -1;
+    }
+    if (config->data_page_size > config->page_size) {
+        // A replay gives every page one frame
+        fprintf(stderr, "Reference strings do not record data pages of several frames\n");
+        return -1;
+    }
+    int page_shift = -1;
+    for (int shift = 0; shift < 30; shift++) {
+        if ((4L << shift) == config->page_size) page_shift = shift;
+    }
+    const int *record = trace->records;
+    for (int i = 0; i < trace->num_processes; i++, record += trace->num_searches + 1) {
+        if (record[0] <= 0 ||
+            ((long)(record[0] - 1) * 4) / config->page_size + config->essential_pages >= PAGE_TABLE_SIZE) {
+            fprintf(stderr, "Array of process %d does not fit in %d pages\n", i, PAGE_TABLE_SIZE);
+            return -1;
+        }
+    }
+    
+    RefRecorder *recorder = open_reference_string(file, config, trace->num_processes);
+    if (!recorder) return -1;
+    unsigned short pages[MAX_PROBES];
+    for (int search = 0; search < trace->num_searches; search++) {
+        record = trace->records;
+        for (int i = 0; i < trace->num_processes; i++, record += trace->num_searches + 1) {
+            int count = probe_pages(page_shift, config->page_size, config->essential_pages, 0, record[0] - 1,
+                                    record[search + 1], pages);
+            record_search(recorder, i, pages, count);
+        }
+    }
+    return close_reference_string(recorder);
+}
+
+// Fenwick tree over reference positions, holding a 1 at the latest
+// reference to each page seen so far
+static void fenwick_add(int32_t *tree, long size, long position, int delta) {
+    for (; position <= size; position += position & -position) tree[position] += delta;
+}
+
+static long fenwick_sum(const int32_t *tree, long position) {
+    long sum = 0;
+    for (; position > 0; position -= position & -position) sum += tree[position];
+    return sum;
+}
+
+// Frames of a replay in replacement order
+typedef struct {
+    int *prev;
+    int *next;
+    int head;
+    int tail;
+} ReplayList;
+
+static void replay_unlink(ReplayList *list, int slot) {
+    if (list->prev[slot] != NO_FRAME) list->next[list->prev[slot]] = list->next[slot];
+    else list->head = list->next[slot];
+    if (list->next[slot] != NO_FRAME) list->prev[list->next[slot]] = list->prev[slot];
+    else list->tail = list->prev[slot];
+}
+
+static void replay_link(ReplayList *list, int slot) {
+    list->prev[slot] = list->tail;
+    list->next[slot] = NO_FRAME;
+    if (list->tail != NO_FRAME) list->next[list->tail] = slot;
+    else list->head = slot;
+    list->tail = slot;
+}
+
+// Faults of policy with global replacement over frames data frames,
+// replayed with the frame list semantics of the simulator: pages are linked
+// at the tail when mapped, LRU moves them there on a hit and CLOCK gives
+// referenced frames a second chance. A process past its last reference
+// releases its data frames, and its essential pages grow the budget.
+// slot_of maps each page to its frame plus one and must come in zeroed.
+static long replay_policy(const RefsHeader *header, const uint32_t *refs, const long *last_ref,
+                          uint32_t *slot_of, int frames, ReplacementPolicy policy) {
+    int capacity = frames + header->num_processes * header->essential_pages;
+    uint32_t *slot_page = malloc(capacity * sizeof(uint32_t));
+    int *free_slots = malloc(capacity * sizeof(int));
+    unsigned char *referenced = calloc(capacity, 1);
+    ReplayList list = {malloc(capacity * sizeof(int)), malloc(capacity * sizeof(int)), NO_FRAME, NO_FRAME};
+    long faults = -1;
+    if (!slot_page || !free_slots || !referenced || !list.prev || !list.next) goto out;
+    
+    int num_free = capacity, limit = frames, resident = 0;
+    for (int i = 0; i < capacity; i++) free_slots[i] = capacity - 1 - i;
+    faults = 0;
+    for (long i = 0; i < header->references; i++) {
+        uint32_t page = refs[i] & ~REF_REPEAT;
+        int slot = (int)slot_of[page] - 1;
+        if (slot >= 0) {
+            if (policy == REPLACE_LRU && slot != list.tail) {
+                replay_unlink(&list, slot);
+                replay_link(&list, slot);
+            } else if (policy == REPLACE_CLOCK) {
+                referenced[slot] = 1;
+            }
+        } else {
+            faults++;
+            if (resident < limit) {
+                slot = free_slots[--num_free];
+                resident++;
+            } else {
+                slot = list.head;
+                while (policy == REPLACE_CLOCK && referenced[slot]) {
+                    referenced[slot] = 0;
+                    replay_unlink(&list, slot);
+                    replay_link(&list, slot);
+                    slot = list.head;
+                }
+                replay_unlink(&list, slot);
+                slot_of[slot_page[slot]] = 0;
+            }
+            slot_page[slot] = page;
+            slot_of[page] = slot + 1;
+            referenced[slot] = 0;
+            replay_link(&list, slot);
+        }
+        if ((refs[i] & REF_REPEAT) && policy == REPLACE_CLOCK) referenced[slot] = 1;
+        
+        uint32_t process_id = page >> REF_PAGE_BITS;
+        if (last_ref[process_id] == i) {
+            for (int s = list.head, next; s != NO_FRAME; s = next) {
+                next = list.next[s];
+                if (slot_page[s] >> REF_PAGE_BITS != process_id) continue;
+                replay_unlink(&list, s);
+                slot_of[slot_page[s]] = 0;
+                free_slots[num_free++] = s;
+                resident--;
+            }
+            limit += header->essential_pages;
+        }
+    }
+out:
+    free(slot_page);
+    free(free_slots);
+    free(referenced);
+    free(list.prev);
+    free(list.next);
+    return faults;
+}
+
+// Print the miss-ratio curve of global LRU replacement for every frame
+// count, from one pass over a recorded reference string (Mattson's stack
+// algorithm: a reference hits in c frames iff fewer than c other pages were
+// referenced since the last reference to its page), then replay each policy
+// at the frame budget of config. The curve keeps the pages of finished
+// processes, which the replay releases as a run does, so the two can differ
+// by the few faults those frames save at the end.
+int replay_reference_string(const char *file, const SimConfig *config) {
+    FILE *fp = fopen(file, "rb");
+    if (!fp) {
+        fprintf(stderr, "Error opening reference string %s\n", file);
+        return -1;
+    }
+    RefsHeader header;
+    if (fread(&header, sizeof(header), 1, fp) != 1 || memcmp(header.magic, REFS_MAGIC, sizeof(header.magic)) != 0 ||
+        header.num_processes <= 0 || header.num_processes > MAX_REF_PROCESSES || header.references < 0 ||
+        header.references >= UINT32_MAX) {
+        fprintf(stderr, "%s is not a reference string\n", file);
+        fclose(fp);
+        return -1;
+    }
+    
+    long count = header.references;
+    size_t pages = (size_t)header.num_processes << REF_PAGE_BITS;
+    uint32_t *refs = malloc((count ? count : 1) * sizeof(uint32_t));
+    uint32_t *last = calloc(pages, sizeof(uint32_t));  // Position of the latest reference, from 1
+    int32_t *tree = calloc(count + 1, sizeof(int32_t));
+    if (!refs || !last || !tree) {
+        fprintf(stderr, "Out of memory for %ld references\n", count);
+        free(refs);
+        free(last);
+        free(tree);
+        fclose(fp);
+        return -1;
+    }
+    if (fread(refs, sizeof(uint32_t), count, fp) != (size_t)count) {
+        fprintf(stderr, "%s is truncated\n", file);
+        free(refs);
+        free(last);
+        free(tree);
+        fclose(fp);
+        return -1;
+    }
+    fclose(fp);
+    
+    // A stack distance is below the number of distinct pages, itself no
+    // more than the references
+    long max_distance = (long)pages < count ? (long)pages : count;
+    long *misses = calloc(max_distance + 2, sizeof(long));
+    if (!misses) {
+        fprintf(stderr, "Out of memory for %ld references\n", count);
+        free(refs);
+        free(last);
+        free(tree);
+        return -1;
+    }
+    long cold = 0;
+    for (long t = 1; t <= count; t++) {
+        uint32_t page = refs[t - 1] & ~REF_REPEAT;
+        if (last[page]) {
+            misses[fenwick_sum(tree, t - 1) - fenwick_sum(tree, last[page])]++;
+            fenwick_add(tree, count, last[page], -1);
+        } else {
+            cold++;
+        }
+        fenwick_add(tree, count, t, 1);
+        last[page] = (uint32_t)t;
+    }
+    free(tree);
+    
+    // misses[c] becomes the faults beyond the cold ones with c frames: the
+    // references at stack distance c or more
+    for (long d = max_distance - 1; d >= 0; d--) misses[d] += misses[d + 1];
+    
+    long distinct = cold;
+    printf("+++ Reference string of %d processes: %ld page accesses, %ld references, %ld distinct pages\n",
+           header.num_processes, (long)header.accesses, count, distinct);
+    printf("frames,faults,miss_ratio\n");
+    // Rows about 8 to a doubling of the frame count, up to where every page fits
+    for (long frames = 1; frames <= distinct;) {
+        long faults = cold + misses[frames];
+        printf("%ld,%ld,%.6f\n", frames, faults, header.accesses ? (double)faults / header.accesses : 0.0);
+        if (frames == distinct) break;
+        long next = frames + frames / 8;
+        frames = next > frames ? next : frames + 1;
+        if (frames > distinct) frames = distinct;
+    }
+    
+    // The budget left for data pages once every process has its essential
+    // pages, as under a replacement policy with all processes resident
+    long data_frames = config->user_frames - (long)header.num_processes * header.essential_pages;
+    int status = 0;
+    if (data_frames <= 0) {
+        printf("+++ No frames left for data pages with %d user frames\n", config->user_frames);
+    } else {
+        int frames = data_frames < distinct ? (int)data_frames : (int)(distinct ? distinct : 1);
+        long *last_ref = malloc(header.num_processes * sizeof(long));
+        long lru = -1, fifo = -1, clock = -1;
+        if (last_ref) {
+            for (int i = 0; i < header.num_processes; i++) last_ref[i] = -1;
+            for (long i = 0; i < count; i++) last_ref[(refs[i] & ~REF_REPEAT) >> REF_PAGE_BITS] = i;
+            memset(last, 0, pages * sizeof(uint32_t));
+            lru = replay_policy(&header, refs, last_ref, last, frames, REPLACE_LRU);
+            memset(last, 0, pages * sizeof(uint32_t));
+            fifo = replay_policy(&header, refs, last_ref, last, frames, REPLACE_FIFO);
+            memset(last, 0, pages * sizeof(uint32_t));
+            clock = replay_policy(&header, refs, last_ref, last, frames, REPLACE_CLOCK);
+            free(last_ref);
+        }
+        if (lru < 0 || fifo < 0 || clock < 0) {
+            fprintf(stderr, "Out of memory for %d frames\n", frames);
+            status = -1;
+        } else {
+            double accesses = header.accesses ? header.accesses : 1;
+            printf("+++ Replay with %d user frames (%ld for data pages, global replacement)\n",
+                   config->user_frames, data_frames);
+            printf("\tLRU page faults                = %7ld (%.2f%% of accesses)\n", lru, 100.0 * lru / accesses);
+            printf("\tFIFO page faults               = %7ld (%.2f%% of accesses)\n", fifo, 100.0 * fifo / accesses);
+            printf("\tCLOCK page faults              = %7ld (%.2f%% of accesses)\n", clock,
+                   100.0 * clock / accesses);
+        }
+    }
+    free(misses);
+    free(last);
+    free(refs);
+    return status;
+}
+
+// Exports are JSON if the file name ends in .json, CSV otherwise
+static int is_json_file(const char *file) {
+    size_t length = strlen(file);
+    return length >= 5 && strcmp(file + length - 5, ".json") == 0;
+}
+
+// FNV-1a over the records, to tell that a checkpoint belongs to a trace
+static uint64_t trace_checksum(const Trace *trace) {
+    size_t count = (size_t)trace->num_processes * (trace->num_searches + 1);
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < count; i++) {
+        hash = (hash ^ (uint32_t)trace->records[i]) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+// Write the complete state of a run to file, in one sequential pass
+int write_checkpoint(const SystemState *system, const SimConfig *config, const Trace *trace, const char *file) {
+    size_t chunks = (system->arena_size + CHECKPOINT_CHUNK - 1) / CHECKPOINT_CHUNK;
+    uint64_t *present = calloc((chunks + 63) / 64, sizeof(uint64_t));
+    FILE *fp = present ? fopen(file, "wb") : NULL;
+    if (!fp) {
+        fprintf(stderr, "Error creating checkpoint %s\n", file);
+        free(present);
+        return -1;
+    }
+    setvbuf(fp, NULL, _IOFBF, 1 << 20);
+    
+    const char *arena = system->arena;
+    for (size_t c = 0; c < chunks; c++) {
+        size_t size = c == chunks - 1 ? system->arena_size - c * CHECKPOINT_CHUNK : CHECKPOINT_CHUNK;
+        for (size_t i = 0; i < size; i++) {
+            if (arena[c * CHECKPOINT_CHUNK + i]) {
+                present[c / 64] |= (uint64_t)1 << (c % 64);
+                break;
+            }
+        }
+    }
+    
+    CheckpointHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+    header.config_size = sizeof(SimConfig);
+    header.state_size = sizeof(SystemState);
+    header.arena_size = system->arena_size;
+    header.arena_base = (uintptr_t)system->arena;
+    header.trace_checksum = trace_checksum(trace);
+    header.num_processes = trace->num_processes;
+    header.num_searches = trace->num_searches;
+    header.num_samples = system->num_samples;
+    
+    int ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+             fwrite(config, sizeof(SimConfig), 1, fp) == 1 &&
+             fwrite(system, sizeof(SystemState), 1, fp) == 1 &&
+             fwrite(present, sizeof(uint64_t), (chunks + 63) / 64, fp) == (chunks + 63) / 64;
+    for (size_t c = 0; ok && c < chunks; c++) {
+        if (!(present[c / 64] >> (c % 64) & 1)) continue;
+        size_t size = c == chunks - 1 ? system->arena_size - c * CHECKPOINT_CHUNK : CHECKPOINT_CHUNK;
+        ok = fwrite(arena + c * CHECKPOINT_CHUNK, 1, size, fp) == size;
+    }
+    if (ok && system->num_samples) {
+        ok = fwrite(system->samples, sizeof(Sample), system->num_samples, fp) == (size_t)system->num_samples;
+    }
+    free(present);
+    if (fclose(fp) != 0) ok = 0;
+    if (!ok) {
+        fprintf(stderr, "Error writing checkpoint %s\n", file);
+        return -1;
+    }
+    return 0;
+}
+
+// Move a pointer into the arena written at old to the same place in the
+// arena at base
+#define REBASE(ptr, old, base) \
+    ((ptr) = (ptr) ? (__typeof__(ptr))((uintptr_t)(ptr) - (old) + (uintptr_t)(base)) : NULL)
+
+// Resume the run checkpointed in file. The checkpoint must belong to trace;
+// *config is replaced with the settings of the checkpointed run, except for
+// those named in branch, which keep the values given.
+int restore_checkpoint(SystemState *system, SimConfig *config, const Trace *trace, const char *file,
+                       unsigned branch) {
+    FILE *fp = fopen(file, "rb");
+    if (!fp) {
+        fprintf(stderr, "Error opening checkpoint %s\n", file);
+        return -1;
+    }
+    
+    CheckpointHeader header;
+    SimConfig saved_config;
+    if (fread(&header, sizeof(header), 1, fp) != 1 ||
+        memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic)) != 0 ||
+        header.config_size != sizeof(SimConfig) || header.state_size != sizeof(SystemState) ||
+        fread(&saved_config, sizeof(SimConfig), 1, fp) != 1) {
+        fprintf(stderr, "%s is not a checkpoint of this simulator\n", file);
+        fclose(fp);
+        return -1;
+    }
+    if (header.num_processes != trace->num_processes || header.num_searches != trace->num_searches ||
+        header.trace_checksum != trace_checksum(trace)) {
+        fprintf(stderr, "Checkpoint %s is of another input\n", file);
+        fclose(fp);
+        return -1;
+    }
+    
+    if (branch & BRANCH_ADMISSION) saved_config.admission = config->admission;
+    if (branch & BRANCH_WINDOW) saved_config.window = config->window;
+    if (branch & BRANCH_VERBOSITY) saved_config.verbosity = config->verbosity;
+    if (branch & BRANCH_SCHEDULER) {
+        if ((saved_config.scheduler == SWAP_WORKING_SET) != (config->scheduler == SWAP_WORKING_SET)) {
+            // Only working-set scheduling keeps per-frame use stamps
+            fprintf(stderr, "A run cannot switch to or from ws scheduling when resumed\n");
+            fclose(fp);
+            return -1;
+        }
+        saved_config.scheduler = config->scheduler;
+    }
+    *config = saved_config;
+    
+    // A fresh, silent set-up gives the arena and every pointer into it
+    SimConfig quiet = saved_config;
+    quiet.verbosity = 0;
+    quiet.sample_interval = 0;
+    if (initialize_system(system, &quiet, trace) != 0) {
+        fclose(fp);
+        return -1;
+    }
+    if (system->arena_size != header.arena_size) {
+        fprintf(stderr, "Checkpoint %s does not match its configuration\n", file);
+        free_system(system);
+        fclose(fp);
+        return -1;
+    }
+    
+    SystemState fresh = *system;
+    size_t chunks = (header.arena_size + CHECKPOINT_CHUNK - 1) / CHECKPOINT_CHUNK;
+    uint64_t *present = calloc((chunks + 63) / 64, sizeof(uint64_t));
+    Sample *samples = header.num_samples > 0 ? malloc(header.num_samples * sizeof(Sample)) : NULL;
+    int ok = present && (header.num_samples <= 0 || samples) &&
+             fread(system, sizeof(SystemState), 1, fp) == 1 &&
+             fread(present, sizeof(uint64_t), (chunks + 63) / 64, fp) == (chunks + 63) / 64;
+    
+    // The counters and queue positions come from the checkpoint, the
+    // pointers from the fresh set-up
+    system->arena = fresh.arena;
+    system->processes = fresh.processes;
+    system->frames.free_map = fresh.frames.free_map;
+    system->frames.summary = fresh.frames.summary;
+    system->frames.unit_map = fresh.frames.unit_map;
+    system->is_active = fresh.is_active;
+    system->current_search = fresh.current_search;
+    system->array_size = fresh.array_size;
+    system->swap_queue.items = fresh.swap_queue.items;
+    system->ready_queue.items = fresh.ready_queue.items;
+    system->resume_queue.items = fresh.resume_queue.items;
+    system->out = fresh.out;
+    system->events = fresh.events;
+    system->frame_owner = fresh.frame_owner;
+    system->frame_page = fresh.frame_page;
+    system->frame_prev = fresh.frame_prev;
+    system->frame_next = fresh.frame_next;
+    system->frame_referenced = fresh.frame_referenced;
+    system->frame_lists = fresh.frame_lists;
+    system->process_stats = fresh.process_stats;
+    system->frame_ready = fresh.frame_ready;
+    system->dataset = fresh.dataset;
+    system->shared_frames = fresh.shared_frames;
+    system->frame_refs = fresh.frame_refs;
+    system->leaves = fresh.leaves;
+    system->free_leaves = fresh.free_leaves;
+    system->tlb_tags = fresh.tlb_tags;
+    system->tlb_used = fresh.tlb_used;
+    system->frame_stamp = fresh.frame_stamp;
+    system->samples = NULL;
+    system->num_samples = system->samples_capacity = 0;
+    free(fresh.samples);
+    system->admission = config->admission;
+    system->scheduler = config->scheduler;
+    system->window = config->window;
+    system->verbosity = config->verbosity;
+    
+    char *arena = system->arena;
+    for (size_t c = 0; ok && c < chunks; c++) {
+        size_t size = c == chunks - 1 ? header.arena_size - c * CHECKPOINT_CHUNK : CHECKPOINT_CHUNK;
+        if (present[c / 64] >> (c % 64) & 1) {
+            ok = fread(arena + c * CHECKPOINT_CHUNK, 1, size, fp) == size;
+        } else {
+            memset(arena + c * CHECKPOINT_CHUNK, 0, size);
+        }
+    }
+    if (ok && samples) {
+        ok = fread(samples, sizeof(Sample), header.num_samples, fp) == (size_t)header.num_samples;
+        system->samples = samples;
+        system->num_samples = system->samples_capacity = header.num_samples;
+        samples = NULL;
+    }
+    free(samples);
+    free(present);
+    fclose(fp);
+    if (!ok) {
+        fprintf(stderr, "Checkpoint %s is truncated\n", file);
+        free_system(system);
+        return -1;
+    }
+    
+    // Pointers stored in the arena itself
+    uintptr_t old = header.arena_base;
+    for (int i = 0; i < system->num_processes; i++) {
+        Process *p = &system->processes[i];
+        REBASE(p->page_table, old, arena);
+        REBASE(p->directory, old, arena);
+        REBASE(p->resident_map, old, arena);
+        REBASE(p->hot_pages, old, arena);
+        REBASE(p->prefetched_map, old, arena);
+        REBASE(p->readahead_map, old, arena);
+        REBASE(p->paths, old, arena);
+        p->search_indices = trace->records + (size_t)i * (trace->num_searches + 1) + 1;
+        if (p->directory) {
+            for (int w = 0; w < RESIDENT_WORDS; w++) REBASE(p->directory[w], old, arena);
+        }
+    }
+    return 0;
+}
+
+static int close_export(FILE *fp, const char *file) {
+    if (fclose(fp) != 0) {
+        fprintf(stderr, "Error writing %s\n", file);
+        return -1;
+    }
+    return 0;
+}
+
+// One row per process: its array size and what its searches cost
+int write_process_stats(const SystemState *system, const char *file) {
+    FILE *fp = fopen(file, "w");
+    if (!fp) {
+        fprintf(stderr, "Error creating %s\n", file);
+        return -1;
+    }
+    
+    int json = is_json_file(file);
+    if (json) fprintf(fp, "[\n");
+    else fprintf(fp, "process,array_size,searches_done,page_accesses,page_faults,swap_outs,peak_frames\n");
+    for (int i = 0; i < system->num_processes; i++) {
+        const ProcessStats *stats = &system->process_stats[i];
+        if (json) {
+            fprintf(fp, "  {\"process\": %d, \"array_size\": %d, \"searches_done\": %d, "
+                        "\"page_accesses\": %ld, \"page_faults\": %ld, \"swap_outs\": %d, "
+                        "\"peak_frames\": %d}%s\n",
+                    i, system->array_size[i], system->current_search[i], stats->page_accesses,
+                    stats->page_faults, stats->swap_outs, stats->peak_frames,
+                    i < system->num_processes - 1 ? "," : "");
+        } else {
+            fprintf(fp, "%d,%d,%d,%ld,%ld,%d,%d\n", i, system->array_size[i], system->current_search[i],
+                    stats->page_accesses, stats->page_faults, stats->swap_outs, stats->peak_frames);
+        }
+    }
+    if (json) fprintf(fp, "]\n");
+    return close_export(fp, file);
+}
+
+// One row per sample of free frames and process counts
+int write_time_series(const SystemState *system, const char *file) {
+    FILE *fp = fopen(file, "w");
+    if (!fp) {
+        fprintf(stderr, "Error creating %s\n", file);
+        return -1;
+    }
+    
+    int json = is_json_file(file);
+    if (json) fprintf(fp, "[\n");
+    else fprintf(fp, "page_accesses,free_frames,active,running,swapped\n");
+    for (int i = 0; i < system->num_samples; i++) {
+        const Sample *sample = &system->samples[i];
+        if (json) {
+            fprintf(fp, "  {\"page_accesses\": %ld, \"free_frames\": %d, \"active\": %d, "
+                        "\"running\": %d, \"swapped\": %d}%s\n",
+                    sample->time, sample->free_frames, sample->active, sample->running,
+                    sample->swapped, i < system->num_samples - 1 ? "," : "");
+        } else {
+            fprintf(fp, "%ld,%d,%d,%d,%d\n", sample->time, sample->free_frames, sample->active,
+                    sample->running, sample->swapped);
+        }
+    }
+    if (json) fprintf(fp, "]\n");
+    return close_export(fp, file);
+}
+
+#ifdef PROFILE
+// Time of phase over the whole run, scaled up from its timed entries
+static double phase_ticks(int phase) {
+    return profile.timed[phase] ? (double)profile.ticks[phase] * profile.entries[phase] / profile.timed[phase] : 0;
+}
+
+// Time per phase of the run, and per unit of work
+static void print_profile(const SystemState *system) {
+    double total = 0;
+    for (int i = 0; i < NUM_PHASES; i++) total += phase_ticks(i);
+    if (total <= 0) total = 1;
+    
+    fprintf(stderr, "+++ Profile (%s)\n", PROFILE_UNIT);
+    for (int i = 0; i < NUM_PHASES; i++) {
+        fprintf(stderr, "\t%-31s= %12.0f (%5.1f%%, %ld entries, %ld timed)\n", phase_labels[i], phase_ticks(i),
+                100.0 * phase_ticks(i) / total, profile.entries[i], profile.timed[i]);
+    }
+    double running = phase_ticks(PHASE_SEARCH) + phase_ticks(PHASE_FAULT) + phase_ticks(PHASE_SWAP);
+    fprintf(stderr, "\tPer page access                = %12.1f\n",
+            system->page_accesses ? running / system->page_accesses : 0.0);
+    fprintf(stderr, "\tPer page fault                 = %12.1f (swapping included)\n",
+            system->page_faults ? (phase_ticks(PHASE_FAULT) + phase_ticks(PHASE_SWAP)) / system->page_faults : 0.0);
+    fprintf(stderr, "\tPer swap-in or swap-out        = %12.1f\n",
+            profile.entries[PHASE_SWAP] ? phase_ticks(PHASE_SWAP) / profile.entries[PHASE_SWAP] : 0.0);
+}
+
+// The profile as one CSV row, or a JSON object, for scripts comparing runs
+static int write_profile(const SystemState *system, const char *file) {
+    FILE *fp = fopen(file, "w");
+    if (!fp) {
+        fprintf(stderr, "Error creating %s\n", file);
+        return -1;
+    }
+    
+    int json = is_json_file(file);
+    if (json) {
+        fprintf(fp, "{\"unit\": \"%s\"", PROFILE_UNIT);
+        for (int i = 0; i < NUM_PHASES; i++) {
+            fprintf(fp, ", \"%s_ticks\": %.0f, \"%s_entries\": %ld, \"%s_timed\": %ld", phase_names[i],
+                    phase_ticks(i), phase_names[i], profile.entries[i], phase_names[i], profile.timed[i]);
+        }
+        fprintf(fp, ", \"page_accesses\": %ld, \"page_faults\": %ld, \"swaps\": %d}\n", system->page_accesses,
+                system->page_faults, system->num_swaps / 2);
+    } else {
+        fprintf(fp, "unit");
+        for (int i = 0; i < NUM_PHASES; i++) {
+            fprintf(fp, ",%s_ticks,%s_entries,%s_timed", phase_names[i], phase_names[i], phase_names[i]);
+        }
+        fprintf(fp, ",page_accesses,page_faults,swaps\n%s", PROFILE_UNIT);
+        for (int i = 0; i < NUM_PHASES; i++) {
+            fprintf(fp, ",%.0f,%ld,%ld", phase_ticks(i), profile.entries[i], profile.timed[i]);
+        }
+        fprintf(fp, ",%ld,%ld,%d\n", system->page_accesses, system->page_faults, system->num_swaps / 2);
+    }
+    return close_export(fp, file);
+}
+#endif
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [-f input_file] [-u user_frames] [-e essential_pages] [-p page_size]\n"
+            "          [-G data_page_size]\n"
+            "          [-r none|fifo|lru|clock] [-a global|local] [-H hot_set_pages]\n"
+            "          [-A greedy|single|ws] [-F]\n"
+            "          [-g workload] [-b runs] [-T event_trace_file] [-v level|categories]\n"
+            "          [-o process_stats.csv|.json] [-t time_series.csv|.json] [-i sample_interval]\n"
+            "          [-k scalar|batch] [-N memory_nodes [-E epoch_steps] [-M] [-j threads]]\n"
+            "          [-d storage] [-P prefetch_pages] [-S size|datasets] [-L page_table_levels]\n"
+            "          [-l tlb] [-W fifo|ws|pff [-w window]]\n"
+            "          [-C checkpoint_file -K steps | -R checkpoint_file]\n"
+            "          [-z profile.csv|.json]\n"
+            "       %s -s sweep_file [-j threads]\n"
+            "       %s -D event_trace_file\n"
+            "       %s -Y reference_string_file [-u user_frames]\n"
+            "       %s -O file|-|tcp:port [-n slots] [-I commands_per_report] [simulation options]\n"
+            "       %s -X golden_output[,golden_output...] [-B baseline_file] [-b runs] [simulation options]\n"
+            "       %s [-f input_file | -g workload] -c binary_trace_file\n"
+            "       %s [-f input_file | -g workload] [-e essential_pages] [-p page_size] -Q reference_string_file\n"
+            "workload: n=200,m=100,size=1000000-2000000,keys=uniform|zipf[:s]|sequential,seed=1\n"
+            "storage: latency=100,bandwidth=500,depth=1,access=100 (us, MB/s, requests, ns)\n"
+            "tlb: entries=64,ways=4,asid,memory=100 (ns per memory access)\n"
+            "verbosity: 0-3, or categories events,searches,faults (default %s)\n",
+            prog, prog, prog, prog, prog, prog, prog, prog, DEFAULT_VERBOSITY & VERBOSE_SEARCHES ? "2" : "1");
+}
+
+int main(int argc, char *argv[]) {
+    SimConfig config;
+    init_config(&config);
+    const char *sweep_file = NULL;
+    const char *convert_file = NULL;
+    int num_threads = 0;
+    const char *workload_spec = NULL;
+    int benchmark_runs = 0;
+    const char *event_file = NULL;
+    const char *decode_file = NULL;
+    const char *process_file = NULL;
+    const char *series_file = NULL;
+    int num_nodes = 0;
+    long epoch = 1000;
+    int migrate = 0;
+    const char *checkpoint_file = NULL;
+    long checkpoint_steps = -1;
+    const char *restore_file = NULL;
+    const char *refs_file = NULL;
+    const char *replay_file = NULL;
+    const char *profile_file = NULL;
+    const char *stream_source = NULL;
+    int stream_slots = 256;
+    long stream_report = 100000;
+    const char *golden_files = NULL;
+    const char *baseline_file = NULL;
+    unsigned branch = 0;  // Settings given for a resumed run
+    
+    int opt;
+    while ((opt = getopt(argc, argv, "f:u:e:p:r:a:H:A:Fg:b:T:D:v:o:t:i:k:N:E:Md:P:S:L:l:W:w:C:K:R:Q:Y:z:G:O:n:I:X:B:s:j:c:")) != -1) {
+        switch (opt) {
+            case 'f': snprintf(config.input_file, MAX_PATH_LEN, "%s", optarg); break;
+            case 'u': config.user_frames = atoi(optarg); break;
+            case 'e': config.essential_pages = atoi(optarg); break;
+            case 'p': config.page_size = atoi(optarg); break;
+            case 'G': config.data_page_size = atoi(optarg); break;
+            case 'r':
+                if (parse_policy(optarg, &config.policy) != 0) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'a':
+                if (parse_scope(optarg, &config.local_replacement) != 0) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'H': config.hot_set_size = atoi(optarg); break;
+            case 'A':
+                if (parse_admission(optarg, &config.admission) != 0) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                branch |= BRANCH_ADMISSION;
+                break;
+            case 'F': config.frame_report = 1; break;
+            case 'g': workload_spec = optarg; break;
+            case 'b': benchmark_runs = atoi(optarg); break;
+            case 'T': event_file = optarg; break;
+            case 'D': decode_file = optarg; break;
+            case 'o': process_file = optarg; break;
+            case 't': series_file = optarg; break;
+            case 'i': config.sample_interval = atol(optarg); break;
+            case 'N': num_nodes = atoi(optarg); break;
+            case 'E': epoch = atol(optarg); break;
+            case 'M': migrate = 1; break;
+            case 'P': config.prefetch_depth = atoi(optarg); break;
+            case 'L': config.page_table_levels = atoi(optarg); break;
+            case 'W':
+                if (parse_scheduler(optarg, &config.scheduler) != 0) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                branch |= BRANCH_SCHEDULER;
+                break;
+            case 'w': config.window = atol(optarg); branch |= BRANCH_WINDOW; break;
+            case 'C': checkpoint_file = optarg; break;
+            case 'K': checkpoint_steps = atol(optarg); break;
+            case 'R': restore_file = optarg; break;
+            case 'Q': refs_file = optarg; break;
+            case 'Y': replay_file = optarg; break;
+            case 'z': profile_file = optarg; break;
+            case 'O': stream_source = optarg; break;
+            case 'n': stream_slots = atoi(optarg); break;
+            case 'I': stream_report = atol(optarg); break;
+            case 'X': golden_files = optarg; break;
+            case 'B': baseline_file = optarg; break;
+            case 'l':
+                if (parse_tlb(optarg, &config.tlb) != 0) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'S':
+                config.datasets = strcmp(optarg, "size") == 0 ? SHARE_BY_SIZE : atoi(optarg);
+                if (config.datasets == 0) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'd':
+                if (parse_storage(optarg, &config.storage) != 0) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'k':
+                if (strcmp(optarg, "batch") != 0 && strcmp(optarg, "scalar") != 0) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                config.batch_search = strcmp(optarg, "batch") == 0;
+                break;
+            case 'v':
+                if (parse_verbosity(optarg, &config.verbosity) != 0) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                branch |= BRANCH_VERBOSITY;
+                break;
+            case 's': sweep_file = optarg; break;
+            case 'j': num_threads = atoi(optarg); break;
+            case 'c': convert_file = optarg; break;
+            default: usage(argv[0]); return 1;
+        }
+    }
+    
+    if (series_file && config.sample_interval <= 0) config.sample_interval = 1000;
+#ifndef PROFILE
+    if (profile_file) {
+        fprintf(stderr, "Profiles need a build with -DPROFILE\n");
+        return 1;
+    }
+#endif
+    if ((checkpoint_file != NULL) != (checkpoint_steps >= 0)) {
+        fprintf(stderr, "A checkpoint needs both a file (-C) and a step count (-K)\n");
+        return 1;
+    }
+    if (baseline_file && !golden_files) {
+        fprintf(stderr, "A throughput baseline (-B) needs a check (-X)\n");
+        return 1;
+    }
+    
+    if (sweep_file) {
+        return run_sweep(sweep_file, num_threads) == 0 ? 0 : 1;
+    }
+    if (decode_file) {
+        return decode_event_trace(decode_file) == 0 ? 0 : 1;
+    }
+    if (replay_file) {
+        return replay_reference_string(replay_file, &config) == 0 ? 0 : 1;
+    }
+    if (stream_source) {
+        if (workload_spec || event_file || refs_file || process_file || series_file || benchmark_runs > 0 ||
+            num_nodes > 0 || checkpoint_file || restore_file || convert_file || profile_file || golden_files) {
+            fprintf(stderr, "A stream runs on its own, on a single memory node\n");
+            return 1;
+        }
+        return run_stream(&config, stream_source, stream_slots, stream_report) == 0 ? 0 : 1;
+    }
+    
+    // Set-up covers reading the input
+    PROFILE_BEGIN(PHASE_SETUP);
+    Trace trace;
+    if (workload_spec) {
+        Workload workload;
+        if (parse_workload(workload_spec, &workload) != 0 || generate_trace(&trace, &workload) != 0) {
+            return 1;
+        }
+        snprintf(config.input_file, MAX_PATH_LEN, "workload %s", workload_spec);
+    } else if (load_trace(&trace, config.input_file) != 0) {
+        return 1;
+    }
+    
+    // Conversion only: store the input as a binary trace for later runs
+    if (convert_file) {
+        int status = write_trace(&trace, convert_file);
+        free_trace(&trace);
+        return status == 0 ? 0 : 1;
+    }
+    if (refs_file) {
+        int status = write_reference_string(&trace, &config, refs_file);
+        free_trace(&trace);
+        return status == 0 ? 0 : 1;
+    }
+    
+    if (golden_files) {
+        if (num_nodes > 0 || event_file || process_file || series_file || checkpoint_file || restore_file) {
+            fprintf(stderr, "A check runs on its own, on a single memory node\n");
+            free_trace(&trace);
+            return 1;
+        }
+        int status = run_check(&config, &trace, golden_files, baseline_file,
+                               benchmark_runs > 0 ? benchmark_runs : CHECK_RUNS);
+        free_trace(&trace);
+        return status == 0 ? 0 : 1;
+    }
+    
+    if (num_nodes > 0) {
+        if (event_file || process_file || series_file || benchmark_runs > 0 || checkpoint_file || restore_file) {
+            fprintf(stderr, "Traces, exports, checkpoints and benchmarks need a single memory node\n");
+            free_trace(&trace);
+            return 1;
+        }
+        int status = run_partitions(&config, &trace, num_nodes, epoch, migrate, num_threads);
+        free_trace(&trace);
+        return status == 0 ? 0 : 1;
+    }
+    
+    if (benchmark_runs > 0) {
+        int status = run_benchmark(&config, &trace, benchmark_runs);
+        free_trace(&trace);
+        return status == 0 ? 0 : 1;
+    }
+    
+    // A traced run prints nothing: decoding the trace gives its output
+    SystemState system;
+    system.out = stdout;
+    system.events = NULL;
+    if (event_file && (checkpoint_file || restore_file)) {
+        fprintf(stderr, "Event traces cannot be checkpointed\n");
+        free_trace(&trace);
+        return 1;
+    }
+    if (event_file) {
+        if (config.storage.queue_depth || config.prefetch_depth || config.datasets || config.tlb.entries) {
+            fprintf(stderr, "Event traces do not record storage timing, read-ahead, sharing or the TLB\n");
+            free_trace(&trace);
+            return 1;
+        }
+        if (config.scheduler != SWAP_FAULTING || config.page_table_levels != 1 ||
+            config.data_page_size > config.page_size) {
+            fprintf(stderr, "Event traces do not record swap scheduling, page table memory or data pages "
+                            "of several frames\n");
+            free_trace(&trace);
+            return 1;
+        }
+        system.events = open_event_trace(event_file, config.verbosity);
+        if (!system.events) {
+            free_trace(&trace);
+            return 1;
+        }
+        config.verbosity = 0;
+    }
+    int ready = restore_file ? restore_checkpoint(&system, &config, &trace, restore_file, branch)
+                             : initialize_system(&system, &config, &trace);
+    PROFILE_END();
+    if (ready != 0) {
+        if (system.events) close_event_trace(&system);
+        free_trace(&trace);
+        return 1;
+    }
+    
+    int status = 0;
+    if (checkpoint_file) {
+        // The run carries on from the checkpointed state as it would have
+        run_quanta(&system, checkpoint_steps);
+        status = write_checkpoint(&system, &config, &trace, checkpoint_file);
+    }
+    // A run that stopped short has no summary worth printing
+    int stuck = run_simulation(&system) != 0;
+    if (stuck) status = -1;
+    
+    {
+        PROFILE_BEGIN(PHASE_OUTPUT);
+        if (system.events) {
+            if (close_event_trace(&system) != 0) status = -1;
+        } else if (!stuck) {
+            print_statistics(&system);
+        }
+        if (process_file && write_process_stats(&system, process_file) != 0) status = -1;
+        if (series_file && write_time_series(&system, series_file) != 0) status = -1;
+        PROFILE_END();
+    }
+#ifdef PROFILE
+    print_profile(&system);
+    if (profile_file && write_profile(&system, profile_file) != 0) status = -1;
+#endif
+    free_system(&system);
+    free_trace(&trace);
+    return status == 0 ? 0 : 1;
+}